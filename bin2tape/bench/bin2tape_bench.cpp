@@ -0,0 +1,245 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+// Conversion benchmark: times input loading, the checksum routines and the conversion to every
+// tape format at payload sizes from 16 bytes to 64 KB, and a batch of 10000 files.
+// The results are written to stdout as JSON.
+//
+// Usage: bin2tape_bench [work_dir]  (temporary files are created in work_dir, default is bench_tmp)
+
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <atomic>
+
+#include <cstdio>
+
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__)
+#include <sys/stat.h>
+#define MKDIR(dir) mkdir(dir, 0777)
+#else
+#include <direct.h>
+#define MKDIR(dir) _mkdir(dir)
+#endif
+
+#include "bin2tape.h"
+#include "checksum.h"
+#include "fileio.h"
+#include "tapeformat.h"
+#include "libbin2tape.h"
+
+
+using namespace std;
+
+
+static const size_t payloadSizes[] = {16, 64, 256, 1024, 4096, 16384, 65536};
+static const int batchFiles = 10000;
+static const int batchSizeCount = 5;   // the batch files cycle through the smaller payload sizes only
+
+
+// returns time per operation in ns
+template <typename F>
+static double measure(F func)
+{
+    using namespace std::chrono;
+
+    size_t iterations = 1;
+
+    for (;;) {
+        auto start = steady_clock::now();
+        for (size_t i = 0; i < iterations; i++)
+            func();
+        double secs = duration<double>(steady_clock::now() - start).count();
+
+        if (secs > 0.05)
+            return secs * 1e9 / iterations;
+
+        iterations *= 2;
+    }
+}
+
+
+class JsonResults
+{
+public:
+    explicit JsonResults(ostream& out) : m_out(out) {}
+
+    void add(const string& name, const char* format, size_t size, double ns)
+    {
+        m_out << (m_first ? "" : ",\n") << "    {\"name\": \"" << name << "\"";
+        if (format)
+            m_out << ", \"format\": \"" << format << "\"";
+        m_out << ", \"size\": " << size << ", \"ns_per_op\": " << ns << ", \"mb_per_s\": " << (size ? size * 1e3 / ns : 0) << "}";
+        m_first = false;
+    }
+
+private:
+    ostream& m_out;
+    bool m_first = true;
+};
+
+
+static const char* formatKey(TapeFileFormat format)
+{
+    static const char* const keys[] = {"rk", "rkp", "rkm", "rku", "rk4", "rks", "rko", "bru", "cas", "lvt"};
+    return keys[format];
+}
+
+
+static bool writeFile(const string& fileName, const vector<uint8_t>& data)
+{
+    OutputChunk chunk = {data.data(), data.size()};
+    return writeChunks(fileName, &chunk, 1);
+}
+
+
+// the same steps as a bin2tape batch job: load, checksums, header and footer, gathered write
+static bool convertFile(const string& inputFile, const string& outputFile, TapeFileFormat format)
+{
+    InputFile body;
+    if (!body.open(inputFile, 0x10000))
+        return false;
+
+    Bin2TapeOptions options = {format, 0, 0, "BENCH"};
+    TapeImage image;
+    bin2tapeImage(body.size(), calcBlockChecksums(body.data(), body.size()), options, image);
+    return writeTapeFile(outputFile, image, body.data(), body.size());
+}
+
+
+int main(int argc, char** argv)
+{
+    string workDir = argc > 1 ? argv[1] : "bench_tmp";
+    MKDIR(workDir.c_str());
+    workDir += "/";
+
+    vector<uint8_t> payload(0x10000);
+    mt19937 rng(1);
+    for (auto& b: payload)
+        b = uint8_t(rng());
+
+    cout.precision(6);
+    cout << "{\n  \"version\": \"" VERSION "\",\n  \"checksum_impl\": \"" << getBestChecksumKernels()->name << "\",\n";
+    cout << "  \"results\": [\n";
+
+    JsonResults results(cout);
+    int result = 0;
+
+    const TapeFileFormat formats[] = {TFF_RK, TFF_RKP, TFF_RKM, TFF_RKU, TFF_RK4, TFF_RKS, TFF_RKO, TFF_BRU, TFF_CAS, TFF_LVT};
+    vector<uint8_t> output(0x10000 + sizeof(FileHeader) + sizeof(FileFooter));
+    volatile uint32_t sink = 0;
+
+    for (size_t size: payloadSizes) {
+        vector<uint8_t> data(payload.begin(), payload.begin() + size);
+
+        string inputFile = workDir + "input.bin";
+        if (!writeFile(inputFile, data)) {
+            cerr << "Can't write " << inputFile << endl;
+            return 1;
+        }
+
+        results.add("load", nullptr, size, measure([&]() {
+            InputFile file;
+            file.open(inputFile, 0x10000);
+            sink = sink + file.size();
+        }));
+
+        results.add("calcRkCs", nullptr, size, measure([&]() {sink = sink + calcRkCs(data.data(), size);}));
+        results.add("calcRkmCs", nullptr, size, measure([&]() {sink = sink + calcRkmCs(data.data(), size);}));
+        results.add("calcRkuCs", nullptr, size, measure([&]() {sink = sink + calcRkuCs(data.data(), size);}));
+        results.add("calcBlockChecksums", nullptr, size, measure([&]() {sink = sink + calcBlockChecksums(data.data(), size).rkCs;}));
+
+        for (TapeFileFormat format: formats) {
+            Bin2TapeOptions options = {format, 0, 0, "BENCH"};
+
+            // in memory conversion including the checksum calculation
+            results.add("convert", formatKey(format), size, measure([&]() {
+                sink = sink + bin2tapeConvert(data.data(), size, options, output.data(), output.size());
+            }));
+
+            // conversion to a file as bin2tape does it
+            string outputFile = workDir + "output." + formatKey(format);
+            results.add("convert_file", formatKey(format), size, measure([&]() {
+                TapeImage image;
+                bin2tapeImage(size, calcBlockChecksums(data.data(), size), options, image);
+                if (!writeTapeFile(outputFile, image, data.data(), size))
+                    result = 1;
+            }));
+            remove(outputFile.c_str());
+        }
+
+        remove(inputFile.c_str());
+    }
+
+    cout << "\n  ],\n";
+
+    // batch: 10000 files of 16-4096 bytes converted to RK by a pool of worker threads
+
+    vector<string> inputFiles;
+    size_t totalSize = 0;
+    for (int i = 0; i < batchFiles; i++) {
+        size_t size = payloadSizes[i % batchSizeCount];
+        inputFiles.push_back(workDir + "b" + to_string(i) + ".bin");
+        if (!writeFile(inputFiles.back(), vector<uint8_t>(payload.begin(), payload.begin() + size))) {
+            cerr << "Can't write " << inputFiles.back() << endl;
+            return 1;
+        }
+        totalSize += size;
+    }
+
+    unsigned nThreads = thread::hardware_concurrency();
+    if (!nThreads)
+        nThreads = 1;
+
+    atomic<int> nextFile(0);
+    atomic<int> nErrors(0);
+    auto worker = [&]() {
+        int idx;
+        while ((idx = nextFile++) < batchFiles)
+            if (!convertFile(inputFiles[idx], cutExtension(inputFiles[idx]) + ".rk", TFF_RK))
+                ++nErrors;
+    };
+
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for (unsigned i = 0; i < nThreads; i++)
+        workers.emplace_back(worker);
+    for (auto& w: workers)
+        w.join();
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    for (const auto& fileName: inputFiles) {
+        remove(fileName.c_str());
+        remove((cutExtension(fileName) + ".rk").c_str());
+    }
+
+    if (nErrors)
+        result = 1;
+
+    cout << "  \"batch\": {\"files\": " << batchFiles << ", \"file_bytes\": \"" << payloadSizes[0] << "-" <<
+            payloadSizes[batchSizeCount - 1] << "\", \"threads\": " << nThreads << ", \"bytes\": " << totalSize <<
+            ", \"seconds\": " << secs << ", \"files_per_s\": " << batchFiles / secs << ", \"errors\": " << nErrors << "}\n}" << endl;
+
+    return result;
+}
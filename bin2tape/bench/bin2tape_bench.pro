@@ -0,0 +1,23 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG -= qt
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    bin2tape_bench.cpp \
+    ../checksum.cpp \
+    ../fileio.cpp \
+    ../tapeformat.cpp \
+    ../libbin2tape.cpp
+
+HEADERS += \
+    ../bin2tape.h \
+    ../checksum.h \
+    ../fileio.h \
+    ../tapeformat.h \
+    ../libbin2tape.h
+
+QMAKE_CXXFLAGS += -pthread
+LIBS += -pthread
@@ -0,0 +1,171 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+// Checksum kernels microbenchmark: checks every kernel supported by the CPU against
+// the reference byte by byte implementation and measures its throughput on 512 byte - 64 KB blocks
+// (512 bytes is the rkdisk sector size).
+
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <random>
+
+#include "checksum.h"
+
+
+using namespace std;
+
+
+// the original bin2tape checksum routines
+static uint16_t refRkCs(const uint8_t* data, int len)
+{
+    uint16_t cs = 0;
+    for (int i = 0; i < len - 1; i++) {
+        cs += data[i];
+        cs += (data[i] << 8);
+    }
+    return (cs & 0xff00) | ((cs + data[len - 1]) & 0xff);
+}
+
+
+static uint16_t refRkmCs(const uint8_t* data, int len)
+{
+    uint16_t cs = 0;
+    for (int i = 0; i < len; i++)
+        cs ^= i & 1 ? data[i] << 8 : data[i];
+    return cs;
+}
+
+
+static uint16_t refRkuCs(const uint8_t* data, int len)
+{
+    uint16_t cs = 0;
+    for (int i = 0; i < len; i++)
+        cs += data[i];
+    return cs;
+}
+
+
+static bool verify(const ChecksumKernels* kernels, const vector<uint8_t>& buf)
+{
+    // all lengths up to 300 bytes and all alignments, then a few large blocks
+    for (int len = 1; len <= 300; len++)
+        for (int offset = 0; offset < 32; offset++) {
+            const uint8_t* data = buf.data() + offset;
+            uint16_t rkCs = (kernels->byteSum(data, len - 1) * 257) & 0xFFFF;
+            rkCs = (rkCs & 0xff00) | ((rkCs + data[len - 1]) & 0xff);
+            if (rkCs != refRkCs(data, len) ||
+                    kernels->wordXor(data, len) != refRkmCs(data, len) ||
+                    uint16_t(kernels->byteSum(data, len)) != refRkuCs(data, len))
+                return false;
+        }
+
+    for (int len = 1; len <= 0x10000; len = len < 300 ? len + 1 : len * 2) {
+        uint32_t sum;
+        if (kernels->sumAndXor(buf.data() + 1, len, sum) != refRkmCs(buf.data() + 1, len) || uint16_t(sum) != refRkuCs(buf.data() + 1, len))
+            return false;
+    }
+
+    for (int len = 1024; len <= 0x10000; len *= 2)
+        if (uint16_t(kernels->byteSum(buf.data() + 1, len)) != refRkuCs(buf.data() + 1, len) ||
+                kernels->wordXor(buf.data() + 1, len) != refRkmCs(buf.data() + 1, len))
+            return false;
+
+    return true;
+}
+
+
+static const size_t c_blockSizes[] = {512, 1024, 4096, 0x4000, 0x10000};
+
+
+// returns throughput in MB/s
+template <typename F>
+static double measure(F func, const vector<uint8_t>& buf, size_t len)
+{
+    using namespace std::chrono;
+
+    volatile uint32_t sink = 0;
+    size_t iterations = 1;
+
+    for (;;) {
+        auto start = steady_clock::now();
+        for (size_t i = 0; i < iterations; i++)
+            sink = sink + func(buf.data(), len);
+        double secs = duration<double>(steady_clock::now() - start).count();
+
+        if (secs > 0.05)
+            return double(len) * iterations / secs / 1e6;
+
+        iterations *= 2;
+    }
+}
+
+
+int main()
+{
+    vector<uint8_t> buf(0x10000 + 64);
+    mt19937 rng(1);
+    for (auto& b: buf)
+        b = uint8_t(rng());
+
+    cout << "Best implementation: " << getBestChecksumKernels()->name << endl << endl;
+
+    cout << left << setw(8) << "kernel" << setw(10) << "routine" << right;
+    for (size_t len: c_blockSizes)
+        cout << setw(8) << (len < 1024 ? len : len / 1024) << (len < 1024 ? "B" : "K");
+    cout << "   (MB/s)" << endl;
+
+    int result = 0;
+
+    for (int impl = 0; impl < CSI_COUNT; impl++) {
+        const ChecksumKernels* kernels = getChecksumKernels(ChecksumImpl(impl));
+        if (!kernels)
+            continue;
+
+        if (!verify(kernels, buf)) {
+            cout << kernels->name << ": results differ from the reference implementation!" << endl;
+            result = 1;
+            continue;
+        }
+
+        cout << left << setw(8) << kernels->name << setw(10) << "byteSum" << right << fixed << setprecision(0);
+        for (size_t len: c_blockSizes)
+            cout << setw(9) << measure(kernels->byteSum, buf, len);
+        cout << endl;
+
+        cout << left << setw(8) << kernels->name << setw(10) << "wordXor" << right;
+        for (size_t len: c_blockSizes)
+            cout << setw(9) << measure(kernels->wordXor, buf, len);
+        cout << endl;
+
+        auto sumAndXor = [kernels](const uint8_t* data, size_t len) {
+            uint32_t sum;
+            return kernels->sumAndXor(data, len, sum) + sum;
+        };
+        cout << left << setw(8) << kernels->name << setw(10) << "sumAndXor" << right;
+        for (size_t len: c_blockSizes)
+            cout << setw(9) << measure(sumAndXor, buf, len);
+        cout << endl;
+    }
+
+    return result;
+}
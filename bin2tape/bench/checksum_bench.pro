@@ -0,0 +1,13 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG -= qt
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    checksum_bench.cpp \
+    ../checksum.cpp
+
+HEADERS += \
+    ../checksum.h
@@ -20,24 +20,39 @@
 
 
 #include <iostream>
-#include <fstream>
 #include <iomanip>
 #include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <sstream>
 
 #include <cstring>
 #include <assert.h>
 
 #include "bin2tape.h"
+#include "checksum.h"
+#include "fileio.h"
+#include "tapeformat.h"
+#include "libbin2tape.h"
+#include "tapeaudio.h"
+#include "convcache.h"
+#include "memmap.h"
+#include "lzpack.h"
+#include "stats.h"
+#include "server.h"
+#include "verify.h"
 
 
 using namespace std;
 
-void usage(string& moduleName)
+void usage(string& moduleName, ostream& out = cout)
 {
-            cout << "Usage: " << moduleName << " [options] input_file.bin [output_file]" << endl << endl <<
+            out << "Usage: " << moduleName << " [options] input_file.bin [output_file]" << endl <<
+            "       " << moduleName << " [options] file@addr [file@addr...] [output_file]" << endl << endl <<
             "options are:" << endl << endl <<
-            "  -t format" << endl <<
-            "    output file format, available formats are:" << endl << endl <<
+            "  -t format[,format...]" << endl <<
+            "    output file format(s), available formats are:" << endl << endl <<
             "      rk  (RK86 and clones, default)" << endl <<
             "      rkr (Radio-86RK)," << endl <<
             "      rkp (Partner)" << endl <<
@@ -61,472 +76,1147 @@ void usage(string& moduleName)
             "    internal file name (for BRU, RKO, RKS, CAS), default is based on input file name" << endl << endl <<
             "  -n-" << endl <<
             "    no internal file name" << endl << endl <<
-            "output_file - output file name, default is based on input file name" << endl;
+            "  -m" << endl <<
+            "    write the segments of a multi-segment input as separate tape files (name_ADDR.ext)" << endl <<
+            "    instead of one contiguous block, short gaps are still filled with zeros" << endl << endl <<
+            "  -z" << endl <<
+            "    pack the program: the tape file contains the LZ packed data and an 8080 depacker" << endl <<
+            "    which unpacks it to the load address and jumps to the run address, the tape file" << endl <<
+            "    is loaded and started at its own (reported) address" << endl << endl <<
+            "  -w" << endl <<
+            "    write tape audio (WAV) instead of the tape image, not available for bru" << endl << endl <<
+            "  -s sample_rate" << endl <<
+            "    WAV sample rate, default = 44100" << endl << endl <<
+            "  -b manifest_file" << endl <<
+            "    batch mode: convert all files listed in manifest_file, one file per line" << endl <<
+            "    in the form \"[options] input_file.bin [output_file]\", lines starting with # are ignored," << endl <<
+            "    options given on the command line are used as defaults" << endl << endl <<
+            "  --tape tape_file" << endl <<
+            "    with -b: write all programs listed in manifest_file one after another into" << endl <<
+            "    a single tape file (cas and rko, other formats with -w only), the manifest lines" << endl <<
+            "    may set the addresses and names of the programs but not formats or output files" << endl << endl <<
+            "  -j threads" << endl <<
+            "    number of worker threads in batch mode, default = number of CPU cores" << endl << endl <<
+            "  -c cache_dir" << endl <<
+            "    use the conversion cache in cache_dir: unchanged files are not converted again," << endl <<
+            "    the output files are hard linked to (or copied from) the cache" << endl << endl <<
+            "  -q" << endl <<
+            "    quiet mode, only errors are reported" << endl << endl <<
+            "  --stats=json" << endl <<
+            "    instead of the messages output the statistics in JSON: phase timings (read, pack," << endl <<
+            "    checksum, header build, write), sizes and checksums of every file, totals and" << endl <<
+            "    throughput of the run; errors go to stderr; not available with --tape" << endl << endl <<
+            "input_file.bin - input file name, \"-\" to read from stdin;" << endl <<
+            "    Intel HEX files (.hex, .ihx) are loaded at the addresses they contain;" << endl <<
+            "    several binary files may be given as file@addr (hex) instead" << endl <<
+            "output_file - output file name, \"-\" to write to stdout (default for stdin input)," << endl <<
+            "    default is based on input file name; with several formats it is used as a base name" << endl << endl <<
+            "When the output is written to stdout all messages go to stderr." << endl << endl <<
+            "Archive verification:" << endl << endl <<
+            "  " << moduleName << " --verify dir [-j threads] [-q]" << endl <<
+            "    check all tape files in the directory tree (by extension): decode the headers" << endl <<
+            "    and recalculate the checksums, report damaged files and the throughput" << endl << endl <<
+            "Server mode:" << endl << endl <<
+            "  " << moduleName << " --serve socket [-j threads]" << endl <<
+            "    run a conversion server on the Unix domain socket, the requests are handled" << endl <<
+            "    by a pool of worker threads (default = number of CPU cores)" << endl << endl <<
+            "  " << moduleName << " --connect socket [options] input_file.bin [output_file]" << endl <<
+            "    pass the conversion to the server, the usual options and file names are accepted;" << endl <<
+            "    if the BIN2TAPE_SERVER environment variable contains the socket name every invocation" << endl <<
+            "    uses the server when it is running and converts locally otherwise" << endl;
 }
 
 
-bool loadFile(string& fileName, vector<uint8_t>& body)
+struct OutputFormat {
+    TapeFileFormat format;
+    string ext;
+    string outputFileName; // filled in by completeParams()
+};
+
+
+struct InputSegment {
+    string fileName;
+    uint16_t addr;
+};
+
+
+struct ConvParams {
+    vector<OutputFormat> formats = {{TFF_RK, "rk", ""}};
+    vector<InputSegment> segments; // file@addr inputs
+    bool hexInput = false;
+    bool minimalBlocks = false;
+    bool pack = false;
+    uint16_t loadAddr = 0;
+    uint16_t runAddr = 0;
+    string intFileName;
+    string inputFileName;
+    string outputFileName;
+    bool wav = false;
+    int sampleRate = TapeAudioRenderer::defaultSampleRate;
+
+    bool loadAddrSpecified = false;
+    bool runAddrSpecified = false;
+    bool intFileSpecified = false;
+    bool inputFileSpecified = false;
+    bool outputFileSpecified = false;
+};
+
+
+// Parses conversion options and file names (the same syntax is used on the command line and in batch manifests).
+// Returns false on error, errorMsg is empty if only usage should be shown.
+bool parseArgs(const vector<string>& args, ConvParams& params, string& errorMsg)
 {
-    ifstream f(fileName, ofstream::binary);
-    if (f.fail())
-        return false;
+    errorMsg.clear();
+
+    for (unsigned i = 0; i < args.size(); i++) {
+        const string& option = args[i];
+
+        if (option == "-t" || option == "-a" || option == "-r" || option == "-n" || option == "-s") {
+            if (++i >= args.size())
+                return false;
+
+            const string& value = args[i];
+
+            if (option == "-t") {
+                // comma separated list of formats
+                params.formats.clear();
+                size_t pos = 0;
+                do {
+                    size_t end = value.find(',', pos);
+                    OutputFormat fmt;
+                    fmt.ext = value.substr(pos, end == string::npos ? string::npos : end - pos);
+                    if (!parseFormat(fmt.ext, fmt.format)) {
+                        errorMsg = "Invalid format specification!";
+                        return false;
+                    }
+                    params.formats.push_back(fmt);
+                    pos = end == string::npos ? end : end + 1;
+                } while (pos != string::npos);
+            } else if (option == "-a" || option == "-r") {
+                char* numEnd;
+                uint16_t addr = strtoul(value.c_str(), &numEnd, 16);
+                if (*numEnd) {
+                    errorMsg = option == "-a" ? "Invalid load address!" : "Invalid run address!";
+                    return false;
+                }
+                if (option == "-a") {
+                    params.loadAddr = addr;
+                    params.loadAddrSpecified = true;
+                } else {
+                    params.runAddr = addr;
+                    params.runAddrSpecified = true;
+                }
+            } else if (option == "-s") {
+                char* numEnd;
+                params.sampleRate = strtoul(value.c_str(), &numEnd, 10);
+                if (*numEnd || params.sampleRate < 8000 || params.sampleRate > 192000) {
+                    errorMsg = "Invalid sample rate!";
+                    return false;
+                }
+            } else { // -n
+                params.intFileName = value;
+                params.intFileSpecified = true;
+            }
+        } else if (option == "-n-") {
+            params.intFileSpecified = true;
+        } else if (option == "-w") {
+            params.wav = true;
+        } else if (option == "-m") {
+            params.minimalBlocks = true;
+        } else if (option == "-z") {
+            params.pack = true;
+        } else {
+            if (option[0] == '-' && option != "-") {
+                errorMsg = "Invalid option:" + option;
+                return false;
+            }
 
-    f.seekg(0, ios_base::end);
+            // file@addr is a segment of a multi-segment input
+            size_t atPos = option.find_last_of('@');
+            if (atPos != string::npos && atPos > 0 && atPos + 1 < option.size()) {
+                char* numEnd;
+                unsigned long addr = strtoul(option.c_str() + atPos + 1, &numEnd, 16);
+                if (!*numEnd) {
+                    if (addr > 0xFFFF) {
+                        errorMsg = "Invalid segment address!";
+                        return false;
+                    }
+                    params.segments.push_back({option.substr(0, atPos), uint16_t(addr)});
+                    continue;
+                }
+            }
+
+            if (!params.inputFileSpecified) {
+                params.inputFileName = option;
+                params.inputFileSpecified = true;
+            } else if (!params.outputFileSpecified) {
+                params.outputFileName = option;
+                params.outputFileSpecified = true;
+            } else
+                return false;
+        }
+    }
 
-    int size = f.tellg();
+    return true;
+}
+
+
+// Fills in the default values which depend on the input file name and output file names for every format.
+// With several formats the output file name is used as a base name, the extension is replaced with the format one.
+bool completeParams(ConvParams& params, string& errorMsg)
+{
+    bool multiFormat = params.formats.size() > 1;
+
+    if (!params.segments.empty()) {
+        // the only file name given besides the segments is the output one
+        if (params.outputFileSpecified) {
+            errorMsg = "Too many file names!";
+            return false;
+        }
+        if (params.inputFileSpecified) {
+            params.outputFileName = params.inputFileName;
+            params.outputFileSpecified = true;
+        }
+        params.inputFileName = params.segments[0].fileName;
+        params.inputFileSpecified = true;
 
-    if (size > 0x10000) {
-        f.close();
+        for (const auto& segment: params.segments)
+            if (segment.fileName == "-") {
+                errorMsg = "Segments can't be read from stdin!";
+                return false;
+            }
+    } else if (params.inputFileName != "-") {
+        string inputFileExt = params.inputFileName.substr(params.inputFileName.find_last_of('.') + 1);
+        for (auto& ch: inputFileExt)
+            ch = tolower(ch);
+        params.hexInput = inputFileExt == "hex" || inputFileExt == "ihx";
+    }
+
+    if (params.pack && params.minimalBlocks) {
+        errorMsg = "Packed program can't be split into blocks!";
         return false;
     }
 
-    f.seekg(ios_base::beg);
-    body.resize(size);
-    f.read((char*)(body.data()), size);
-    if (f.fail())
+    if ((!params.segments.empty() || params.hexInput) && params.loadAddrSpecified) {
+        errorMsg = "Load address is defined by the input file(s)!";
         return false;
+    }
 
-    f.close();
+    if (params.inputFileName == "-") {
+        // stdin: no name to derive anything from
+        if (!params.outputFileSpecified && !multiFormat) {
+            params.outputFileName = "-";
+            params.outputFileSpecified = true;
+        }
+    } else {
+        string inputFileNameWoPath = params.inputFileName.substr(params.inputFileName.find_last_of("/\\:") + 1);
 
-    return true;
-}
+        if (!params.intFileSpecified)
+            params.intFileName = inputFileNameWoPath;
 
+        string inputFileExt = params.inputFileName.substr(params.inputFileName.find_last_of('.') + 1);
+        if (!params.loadAddrSpecified && (inputFileExt == "com" || inputFileExt == "COM"))
+            params.loadAddr = 0x100;
 
-const uint8_t* makeIntName(string baseName, int len)
-{
-    // cut off the extention if any
-    baseName = baseName.substr(0, baseName.find_first_of('.'));
+        if (!params.outputFileSpecified)
+            params.outputFileName = cutExtension(inputFileNameWoPath);
+    }
 
-    static uint8_t intName[8];
+    if (!params.runAddrSpecified)
+        params.runAddr = params.loadAddr;
 
-    int i = 0;
-    while (i < len) {
-        char ch = baseName[i];
+    if (multiFormat && (params.outputFileName == "-" || params.outputFileName.empty())) {
+        errorMsg = "Several formats can't be written to stdout!";
+        return false;
+    }
 
-        if (!ch)
-            break;
+    for (auto& fmt: params.formats) {
+        if (params.wav && !TapeAudioRenderer::isSupported(fmt.format)) {
+            errorMsg = string(tapeFormatDesc(fmt.format).name) + " format can't be written as WAV!";
+            return false;
+        }
 
-        if ((ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || ch == ' ')
-            ch = ch >= 'a' && ch <= 'z' ? ch - 0x20 : ch;
+        if (params.outputFileSpecified && !multiFormat)
+            fmt.outputFileName = params.outputFileName;
+        else if (params.wav)
+            fmt.outputFileName = cutExtension(params.outputFileName) + (multiFormat ? "." + fmt.ext : "") + ".wav";
         else
-            ch = '-';
+            fmt.outputFileName = cutExtension(params.outputFileName) + "." + fmt.ext;
+    }
 
-        intName[i] = uint8_t(ch);
+    return true;
+}
 
-        ++i;
+
+bool convert(const uint8_t* body, size_t bodySize, const BlockChecksums& bodyCs, const ConvParams& params, const OutputFormat& fmt,
+             const string& outputFileName, OutputStats* stats = nullptr)
+{
+    Bin2TapeOptions options = {fmt.format, params.loadAddr, params.runAddr, params.intFileName.c_str()};
+
+    StatsTimer timer;
+
+    TapeImage image;
+    bin2tapeImage(bodySize, bodyCs, options, image);
+
+    bool ok;
+    if (params.wav) {
+        if (!TapeAudioRenderer::isSupported(fmt.format))
+            return false;
+        TapeAudioRenderer renderer(fmt.format, params.sampleRate);
+        if (stats) {
+            stats->buildTime = timer.lap();
+            stats->bytesOut = renderer.wavSize(image, bodySize);
+            timer.lap();
+        }
+        ok = renderer.writeWav(outputFileName, image, body, bodySize);
+    } else {
+        if (stats) {
+            stats->buildTime = timer.lap();
+            stats->bytesOut = image.headerSize + bodySize + image.footerSize;
+        }
+        ok = writeTapeFile(outputFileName, image, body, bodySize);
     }
 
-    while (i < len)
-        intName[i++] = 0x20;
+    if (stats)
+        stats->writeTime = timer.lap();
 
-    return intName;
+    return ok;
 }
 
 
-uint16_t addToRkCs(uint16_t baseCs, const uint8_t* data, int len, bool lastChunk = false)
+// Converts through the cache if it's used: on a hit the cached output is reused, otherwise the output
+// is written into the cache and then linked to its place
+bool convert(const uint8_t* body, size_t bodySize, const BlockChecksums& bodyCs, const ConvParams& params, const OutputFormat& fmt,
+             ConversionCache* cache, OutputStats* stats)
 {
-    if (lastChunk)
-        --len;
+    if (!cache)
+        return convert(body, bodySize, bodyCs, params, fmt, fmt.outputFileName, stats);
 
-    for (int i = 0; i < len; i++) {
-        baseCs += data[i];
-        baseCs += (data[i] << 8);
+    uint8_t intFileNameBuf[8];
+    int intFileNameLen = intFileNameLength(fmt.format);
+    if (intFileNameLen)
+        makeIntName(params.intFileName, intFileNameLen, intFileNameBuf);
+
+    // everything the output depends on
+    CacheKeyBuilder keyBuilder;
+    keyBuilder.add(VERSION, sizeof(VERSION));
+    keyBuilder.add(int(fmt.format));
+    keyBuilder.add(params.loadAddr);
+    keyBuilder.add(params.runAddr);
+    keyBuilder.add(intFileNameBuf, intFileNameLen);
+    keyBuilder.add(params.wav ? params.sampleRate : 0);
+    keyBuilder.add(body, bodySize);
+    CacheKey key = keyBuilder.key();
+
+    StatsTimer timer;
+    if (cache->lookup(key, fmt.outputFileName)) {
+        if (stats) {
+            stats->writeTime = timer.lap();
+            stats->cacheHit = true;
+            if (params.wav) {
+                TapeImage image;
+                Bin2TapeOptions options = {fmt.format, params.loadAddr, params.runAddr, params.intFileName.c_str()};
+                bin2tapeImage(bodySize, bodyCs, options, image);
+                stats->bytesOut = TapeAudioRenderer(fmt.format, params.sampleRate).wavSize(image, bodySize);
+            } else
+                stats->bytesOut = tapeFileSize(fmt.format, bodySize);
+            // nothing is built on a hit, only the size of the output is calculated
+            stats->buildTime = timer.lap();
+        }
+        return true;
     }
 
-    if (lastChunk)
-        baseCs = (baseCs & 0xff00) | ((baseCs + data[len]) & 0xff);
+    // the lookup and the insertion into the cache are counted as writing
+    string tempFileName = cache->tempFileName(key);
+    if (convert(body, bodySize, bodyCs, params, fmt, tempFileName, stats) && cache->insert(key, tempFileName, fmt.outputFileName)) {
+        if (stats)
+            stats->writeTime = timer.lap() - stats->buildTime;
+        return true;
+    }
 
-    return baseCs;
+    // the cache directory is not writable etc.
+    remove(tempFileName.c_str());
+    return convert(body, bodySize, bodyCs, params, fmt, fmt.outputFileName, stats);
 }
 
 
-uint16_t calcRkCs(vector<uint8_t>& data)
+struct BatchJob {
+    ConvParams params;
+    int line;
+    bool ok;
+    string errorMsg;
+    InputStats stats;
+};
+
+
+// Splits a manifest line into arguments, double quotes may be used for names with spaces
+vector<string> splitManifestLine(const string& line)
 {
-    return addToRkCs(0, data.data(), data.size(), true);
+    vector<string> args;
+    string arg;
+    bool inArg = false;
+    bool inQuotes = false;
+
+    for (char ch: line) {
+        if (ch == '"') {
+            inQuotes = !inQuotes;
+            inArg = true;
+        } else if ((ch == ' ' || ch == '\t' || ch == '\r') && !inQuotes) {
+            if (inArg)
+                args.push_back(arg);
+            arg.clear();
+            inArg = false;
+        } else {
+            arg.push_back(ch);
+            inArg = true;
+        }
+    }
+    if (inArg)
+        args.push_back(arg);
+
+    return args;
 }
 
 
-uint16_t calcRkmCs(vector<uint8_t>& data)
+// Input data split into the blocks written as separate tape files
+struct InputData {
+    InputFile file;
+    MemoryMap map;
+    vector<MemoryBlock> blocks;
+    uint16_t runAddr;
+
+    // -z: the block is replaced with a self-extracting program
+    SelfExtractingProgram packed;
+    MemoryBlock unpackedBlock;
+    uint16_t unpackedRunAddr;
+};
+
+
+// Tape time taken by a separate block besides its data: header, footer and about 256 bytes of pilot tone
+static size_t blockOverhead(const ConvParams& params)
 {
-    uint16_t cs = 0;
-    for (uint16_t i = 0; i < data.size(); i++)
-        cs ^= i & 1 ? data.data()[i] << 8 : data.data()[i];
-    return cs;
+    size_t overhead = 0;
+    for (const auto& fmt: params.formats)
+        overhead = max(overhead, tapeFileSize(fmt.format, 0) + 256);
+    return overhead;
 }
 
 
-uint16_t calcRkuCs(vector<uint8_t>& data)
+// Replaces the input block with a self-extracting program which unpacks it to its address
+static bool packInput(InputData& input, string& errorMsg)
 {
-    uint16_t cs = 0;
-    for (uint16_t i = 0; i < data.size(); i++)
-        cs += data.data()[i];
-    return cs;
+    const MemoryBlock& block = input.blocks[0];
+    if (!makeSelfExtracting(block.data, block.size, block.addr, input.runAddr, input.packed)) {
+        errorMsg = "packed program doesn't fit into the address space";
+        return false;
+    }
+
+    input.unpackedBlock = block;
+    input.unpackedRunAddr = input.runAddr;
+    input.blocks[0] = {input.packed.loadAddr, input.packed.data.size(), input.packed.data.data()};
+    input.runAddr = input.packed.loadAddr;
+    return true;
 }
 
 
-bool convert(vector<uint8_t> body, TapeFileFormat format, uint16_t loadAddr, uint16_t startAddr, string& outputFile, const uint8_t* intFileName)
+// Loads a raw binary, an Intel HEX file or several segments and splits the data into blocks
+static bool readInput(const ConvParams& params, InputData& input, string& errorMsg, size_t& bytesIn)
 {
-    int endAddr = loadAddr + body.size() - 1;
-
-    int headerSize = 0;
-    int footerSize = 0;
-
-    FileHeader header;
-    FileFooter footer;
-
-    const char* headerPtr = (const char*)&header;
-    const char* footerPtr = (const char*)&footer;
-
-    uint16_t cs;
-    int paddingSize;
-
-    switch (format) {
-    case TFF_RK:
-    case TFF_RKP:
-    case TFF_RKM:
-    case TFF_RKU:
-    case TFF_RK4:
-        headerSize = sizeof(RkHeader);
-        header.rkHeader.loadAddrHi = loadAddr >> 8;
-        header.rkHeader.loadAddrLo = loadAddr & 0xFF;
-        header.rkHeader.endAddrHi = endAddr >> 8;
-        header.rkHeader.endAddrLo = endAddr & 0xFF;
-
-        switch (format) {
-        case TFF_RKM:
-            cs = calcRkmCs(body);
-            break;
-        case TFF_RKU:
-            cs = calcRkuCs(body);
-            break;
-        default:
-            cs = calcRkCs(body);
+    input.blocks.clear();
+    bytesIn = 0;
+
+    if (params.segments.empty() && !params.hexInput) {
+        if (!input.file.open(params.inputFileName, MemoryMap::addrSpaceSize)) {
+            errorMsg = "input file error";
+            return false;
         }
+        bytesIn = input.file.size();
+        MemoryBlock block = {params.loadAddr, input.file.size(), input.file.data()};
+        input.blocks.push_back(block);
+        input.runAddr = params.runAddr;
+        return true;
+    }
 
-        if (format == TFF_RK || format == TFF_RKU) {
-            footerSize = sizeof(RkFooter);
-            footer.rkFooter.nullByte1 = 0;
-            footer.rkFooter.nullByte2 = 0;
-            footer.rkFooter.syncByte = 0xE6;
-            footer.rkFooter.csHi = cs >> 8;
-            footer.rkFooter.csLo = cs & 0xFF;
-        } else if (format == TFF_RKP) {
-            footerSize = sizeof(RkpFooter);
-            footer.rkpFooter.nullByte = 0;
-            footer.rkpFooter.syncByte = 0xE6;
-            footer.rkpFooter.csHi = cs >> 8;
-            footer.rkpFooter.csLo = cs & 0xFF;
-        } else if (format == TFF_RK4) {
-            footerSize = sizeof(Rk4Footer);
-            memset(footer.rk4Footer.nullBytes, 0, sizeof(footer.rk4Footer.nullBytes));
-            footer.rk4Footer.syncByte = 0xE6;
-            footer.rk4Footer.csHi1= cs >> 8;
-            footer.rk4Footer.csLo1 = cs & 0xFF;
-            footer.rk4Footer.csHi2= cs >> 8;
-            footer.rk4Footer.csLo2 = cs & 0xFF;
-        } else if (format == TFF_RKM) {
-            footerSize = sizeof(RkmFooter);
-            footer.rkmFooter.csHi = cs >> 8;
-            footer.rkmFooter.csLo = cs & 0xFF;
+    if (params.hexInput) {
+        // an Intel HEX file of full 64K is about 180K
+        if (!input.file.open(params.inputFileName, 0x100000)) {
+            errorMsg = "input file error";
+            return false;
         }
-        break;
-    case TFF_RKS:
-        cs = calcRkCs(body);
-
-        headerSize = sizeof(RksHeader);
-        header.rksHeader.loadAddrHi = loadAddr >> 8;
-        header.rksHeader.loadAddrLo = loadAddr & 0xFF;
-        header.rksHeader.endAddrHi = endAddr >> 8;
-        header.rksHeader.endAddrLo = endAddr & 0xFF;
-
-        footerSize = sizeof(RksFooter);
-        footer.rksFooter.csHi = cs >> 8;
-        footer.rksFooter.csLo = cs & 0xFF;
-        break;
-    case TFF_BRU:
-        headerSize = sizeof(BruHeader);
-        memcpy(&header.bruHeader.name, intFileName, 8);
-        header.bruHeader.loadAddrHi = loadAddr >> 8;
-        header.bruHeader.loadAddrLo = loadAddr & 0xFF;
-        header.bruHeader.lenHi = (endAddr - loadAddr + 1) >> 8;
-        header.bruHeader.lenLo = (endAddr - loadAddr + 1) & 0xFF;
-        header.bruHeader.attr = 0;
-        memset(header.bruHeader.ff, 0xFF, sizeof(header.bruHeader.ff));
-        footerSize = 0;
-        break;
-    case TFF_RKO:
-        headerSize = sizeof(RkoHeader);
-
-        memcpy(&header.rkoHeader.name, intFileName, 8);
-        header.rkoHeader.loadAddrHi = loadAddr >> 8;
-        header.rkoHeader.loadAddrLo = loadAddr & 0xFF;
-        header.rkoHeader.lenHi = (endAddr - loadAddr + 1 + 16) >> 8;
-        header.rkoHeader.lenLo = (endAddr - loadAddr + 1 + 16) & 0xFF;
-        header.rkoHeader.syncByte = 0xE6;
-        memset(header.rkoHeader.nullBytes, 0, sizeof(header.rkoHeader.nullBytes));
-
-        header.rkoHeader.bruHeader.loadAddrHi = loadAddr >> 8;
-        header.rkoHeader.bruHeader.loadAddrLo = loadAddr & 0xFF;
-        header.rkoHeader.bruHeader.lenHi = (endAddr - loadAddr + 1) >> 8;
-        header.rkoHeader.bruHeader.lenLo = (endAddr - loadAddr + 1) & 0xFF;
-        header.rkoHeader.bruHeader.attr = 0;
-        memset(header.rkoHeader.bruHeader.ff, 0xFF, sizeof(header.rkoHeader.bruHeader.ff));
-        memcpy(&header.rkoHeader.bruHeader.name, intFileName, 8);
-
-        memset(footer.rkoFooter.padding, 0, sizeof(footer.rkoFooter.padding));
-        footer.rkoFooter.syncByte = 0xE6;
-
-        cs = addToRkCs(0, (uint8_t*)(&header.rkoHeader.bruHeader), sizeof(BruHeader), false);
-        cs = addToRkCs(cs, body.data(), body.size(), false);
-        cs = addToRkCs(cs, footer.rkoFooter.padding, 3, true);
-
-        footer.rkoFooter.csHi = cs >> 8;
-        footer.rkoFooter.csLo = cs & 0xFF;
-        paddingSize = (-headerSize - body.size()) & 0x0F;
-        footerSize = paddingSize + 3 /* syncByte + csHi + csLo */;
-        footerPtr += (sizeof(footer.rkoFooter.padding) - paddingSize);
-        break;
-    case TFF_CAS:
-        headerSize = sizeof(CasHeader);
-        memcpy(&header.casHeader.name, intFileName, 6);
-        header.casHeader.loadAddrHi = loadAddr >> 8;
-        header.casHeader.loadAddrLo = loadAddr & 0xFF;
-        header.casHeader.endAddrHi = endAddr >> 8;
-        header.casHeader.endAddrLo = endAddr & 0xFF;
-        header.casHeader.runAddrHi = startAddr >> 8;
-        header.casHeader.runAddrLo = startAddr & 0xFF;
-        memset(header.casHeader.d0, 0xD0, sizeof(header.casHeader.d0));
-        memset(header.casHeader.padding, 0, sizeof(header.casHeader.padding));
-        memcpy(header.casHeader.casSignature1, casSignature, sizeof(header.casHeader.casSignature1));
-        memcpy(header.casHeader.casSignature2, casSignature, sizeof(header.casHeader.casSignature2));
-        footerSize = 0;
-        break;
-    case TFF_LVT:
-        headerSize = sizeof(LvtHeader);
-        memcpy(&header.lvtHeader.name, intFileName, 6);
-        header.lvtHeader.loadAddrHi = loadAddr >> 8;
-        header.lvtHeader.loadAddrLo = loadAddr & 0xFF;
-        header.lvtHeader.endAddrHi = endAddr >> 8;
-        header.lvtHeader.endAddrLo = endAddr & 0xFF;
-        header.lvtHeader.runAddrHi = startAddr >> 8;
-        header.lvtHeader.runAddrLo = startAddr & 0xFF;
-        header.lvtHeader.d0 = 0xD0;
-        memcpy(header.lvtHeader.lvtSignature, lvtSignature, sizeof(header.lvtHeader.lvtSignature));
-        footerSize = 0;
-        break;
-    }
-
-    ofstream f(outputFile, ofstream::binary);
-    if (f.fail())
-        return false;
-    f.write(headerPtr, headerSize);
-    f.write((const char*)(body.data()), body.size());
-    f.write(footerPtr, footerSize);
-    if (f.fail()) {
-        f.close();
+        bytesIn = input.file.size();
+        if (!input.map.addIntelHex(input.file.data(), input.file.size(), errorMsg))
+            return false;
+    } else {
+        for (const auto& segment: params.segments) {
+            InputFile file;
+            if (!file.open(segment.fileName, MemoryMap::addrSpaceSize)) {
+                errorMsg = segment.fileName + ": input file error";
+                return false;
+            }
+            bytesIn += file.size();
+            if (!input.map.add(segment.addr, file.data(), file.size(), errorMsg)) {
+                errorMsg = segment.fileName + ": " + errorMsg;
+                return false;
+            }
+        }
+    }
+
+    if (input.map.empty()) {
+        errorMsg = "no data in input file(s)";
         return false;
     }
-    f.close();
+
+    // a gap which takes less time on tape than a separate block is kept
+    if (params.minimalBlocks)
+        input.blocks = input.map.blocks(blockOverhead(params));
+    else
+        input.blocks.push_back(input.map.contiguousBlock());
+
+    if (params.runAddrSpecified)
+        input.runAddr = params.runAddr;
+    else
+        input.runAddr = input.map.hasStartAddr() ? input.map.startAddr() : input.blocks[0].addr;
 
     return true;
 }
 
 
-int main(int argc, const char** argv)
+bool loadInput(const ConvParams& params, InputData& input, string& errorMsg, InputStats* stats = nullptr)
 {
-    static_assert(sizeof(RkFooter) == 5, "Packed structs required!");
+    StatsTimer timer;
+    size_t bytesIn;
+
+    bool ok = readInput(params, input, errorMsg, bytesIn);
+    if (stats) {
+        stats->fileName = params.inputFileName;
+        stats->bytesIn = bytesIn;
+        stats->readTime = timer.lap();
+    }
+    if (!ok || !params.pack)
+        return ok;
 
-    cout << "bin2tape v. " VERSION " (c) Viktor Pykhonin, 2021-2023" << endl << endl;
-    string moduleName = argv[0];
-    moduleName = moduleName.substr(moduleName.find_last_of("/\\:") + 1);
+    ok = packInput(input, errorMsg);
+    if (stats)
+        stats->packTime = timer.lap();
+    return ok;
+}
 
-    TapeFileFormat format  = TFF_RK;
-    string ext = "rk";
-    uint16_t loadAddr = 0;
-    uint16_t runAddr = 0;
-    string intFileName;
-    string inputFileName;
-    string outputFileName;
 
-    bool loadAddrSpecified = false;
-    bool runAddrSpecified = false;
-    bool intFileSpecified = false;
-    bool inputFileSpecified = false;
-    bool outputFileSpecified = false;
+// name_ADDR.ext, for the output files of several blocks
+string blockFileName(const string& fileName, uint16_t addr)
+{
+    ostringstream suffix;
+    suffix << "_" << setfill('0') << setw(4) << uppercase << hex << addr;
 
-    // parse command line
+    string baseName = cutExtension(fileName);
+    return baseName + suffix.str() + fileName.substr(baseName.size());
+}
 
-    if (argc < 2) {
-        usage(moduleName);
-        return 1;
-    }
 
-    int i = 1;
-    string option, value;
-    while (i < argc) {
-        option = argv[i];
+// Converts all blocks of the input to all formats, the checksums of every block are calculated once for all formats
+bool convertInput(const InputData& input, const ConvParams& params, ConversionCache* cache, ostream& msg, string& errorMsg,
+                  InputStats* stats = nullptr)
+{
+    bool multiBlock = input.blocks.size() > 1;
+
+    for (const auto& block: input.blocks) {
+        ConvParams blockParams = params;
+        blockParams.loadAddr = block.addr;
+        blockParams.runAddr = input.runAddr;
+
+        StatsTimer timer;
+        BlockChecksums bodyCs = calcBlockChecksums(block.data, block.size);
+
+        BlockStats* blockStats = nullptr;
+        if (stats) {
+            stats->blocks.emplace_back();
+            blockStats = &stats->blocks.back();
+            blockStats->checksumTime = timer.lap();
+            blockStats->addr = block.addr;
+            blockStats->size = block.size;
+            blockStats->cs = bodyCs;
+        }
 
-        if (option == "-t") {
-            ++i;
-            if (i > argc) {
-                usage(moduleName);
-                return 1;
-            }
-            value = argv[i];
-            ext = value;
-
-            if (value == "rk" || value == "rkr" || value == "rka" || value == "rk8" || value == "rke" || value == "rkl")
-                format = TFF_RK;
-            else if (value == "rkm")
-                format = TFF_RKM;
-            else if (value == "rku")
-                format = TFF_RKU;
-            else if (value == "rks")
-                format = TFF_RKS;
-            else if (value == "rko")
-                format = TFF_RKO;
-            else if (value == "bru" || value == "ord")
-                format = TFF_BRU;
-            else if (value == "rkp")
-                format = TFF_RKP;
-            else if (value == "rk4")
-                format = TFF_RK4;
-            else if (value == "cas")
-                format = TFF_CAS;
-            else if (value == "lvt")
-                format = TFF_LVT;
-            else {
-                cout << "Invalid format specification!" << endl << endl;
-                usage(moduleName);
-                return 1;
-            }
-        } else if (option == "-a") {
-            ++i;
-            if (i > argc) {
-                usage(moduleName);
-                return 1;
-            }
-            value = argv[i];
-
-            char* numEnd;
-            loadAddr = strtoul(value.c_str(), &numEnd, 16);
-            loadAddrSpecified = true;
-            if (*numEnd) {
-                cout << "Invalid load address!" << endl << endl;
-                usage(moduleName);
-                return 1;
-            }
-        } else if (option == "-r") {
-            ++i;
-            if (i > argc) {
-                usage(moduleName);
-                return 1;
+        for (auto fmt: params.formats) {
+            if (multiBlock) {
+                if (fmt.outputFileName == "-") {
+                    errorMsg = "several blocks can't be written to stdout";
+                    return false;
+                }
+                fmt.outputFileName = blockFileName(fmt.outputFileName, block.addr);
             }
-            value = argv[i];
-
-            char* numEnd;
-            runAddr = strtoul(value.c_str(), &numEnd, 16);
-            runAddrSpecified = true;
-            if (*numEnd) {
-                cout << "Invalid run address!" << endl << endl;
-                usage(moduleName);
-                return 1;
+
+            msg << "Writing " << (fmt.outputFileName == "-" ? "stdout" : fmt.outputFileName) << " ... ";
+
+            OutputStats* outputStats = nullptr;
+            if (blockStats) {
+                blockStats->outputs.emplace_back();
+                outputStats = &blockStats->outputs.back();
+                outputStats->fileName = fmt.outputFileName;
+                outputStats->format = fmt.ext;
             }
-        } else if (option == "-n") {
-            ++i;
-            if (i > argc) {
-                usage(moduleName);
-                return 1;
+
+            if (!convert(block.data, block.size, bodyCs, blockParams, fmt, cache, outputStats)) {
+                msg << "error!" << endl;
+                errorMsg = "error writing " + fmt.outputFileName;
+                return false;
             }
-            value = argv[i];
 
-            intFileName = value;
-            intFileSpecified = true;
-        } else if (option == "-n-") {
-            intFileSpecified = true;
+            msg << "done." << endl;
+        }
+    }
+
+    return true;
+}
+
+
+void runBatchJob(BatchJob& job, ConversionCache* cache, bool collectStats)
+{
+    InputStats* stats = collectStats ? &job.stats : nullptr;
+
+    InputData input;
+    if (loadInput(job.params, input, job.errorMsg, stats)) {
+        ostream nullStream(nullptr);
+        job.ok = convertInput(input, job.params, cache, nullStream, job.errorMsg, stats);
+    }
+
+    job.stats.ok = job.ok;
+    job.stats.errorMsg = job.errorMsg;
+}
+
+
+// Reads the manifest: each line has the same syntax as the command line, [options] input_file [output_file],
+// options given on the command line are used as defaults for every line.
+// Returns the number of invalid lines (they are reported) or -1 if the manifest can't be read.
+int readManifest(const string& manifestFileName, const ConvParams& defaultParams, vector<BatchJob>& jobs, ostream& err)
+{
+    InputFile manifestFile;
+    if (!manifestFile.open(manifestFileName, size_t(-1))) {
+        err << "Error opening manifest file " << manifestFileName << endl;
+        return -1;
+    }
+    istringstream manifest(string(reinterpret_cast<const char*>(manifestFile.data()), manifestFile.size()));
+    manifestFile.close();
+
+    int nErrors = 0;
+
+    string line;
+    int lineNum = 0;
+    while (getline(manifest, line)) {
+        ++lineNum;
+
+        vector<string> args = splitManifestLine(line);
+        if (args.empty() || args[0][0] == '#')
+            continue;
+
+        BatchJob job;
+        job.params = defaultParams;
+        job.line = lineNum;
+        job.ok = false;
+
+        if (!parseArgs(args, job.params, job.errorMsg) || (!job.params.inputFileSpecified && job.params.segments.empty()) ||
+                job.params.inputFileName == "-" || job.params.outputFileName == "-") {
+            if (job.errorMsg.empty())
+                job.errorMsg = job.params.inputFileSpecified ? "stdin/stdout can't be used in batch mode" : "invalid arguments";
+            err << manifestFileName << ":" << lineNum << ": " << job.errorMsg << endl;
+            ++nErrors;
+            continue;
+        }
+
+        if (!completeParams(job.params, job.errorMsg)) {
+            err << manifestFileName << ":" << lineNum << ": " << job.errorMsg << endl;
+            ++nErrors;
+            continue;
+        }
+
+        jobs.push_back(job);
+    }
+
+    return nErrors;
+}
+
+
+// Converts all files listed in the manifest using a pool of worker threads
+// The statistics are written to statsOut if it's not null.
+int runBatch(const string& manifestFileName, const ConvParams& defaultParams, unsigned nThreads, ConversionCache* cache,
+             ostream& msg, ostream& err, ostream* statsOut)
+{
+    StatsTimer wallTimer;
+
+    vector<BatchJob> jobs;
+    int nErrors = readManifest(manifestFileName, defaultParams, jobs, err);
+    if (nErrors < 0)
+        return 1;
+
+    if (!nThreads)
+        nThreads = thread::hardware_concurrency();
+    if (!nThreads)
+        nThreads = 1;
+    if (nThreads > jobs.size())
+        nThreads = jobs.size();
+
+    // the workers see the same files as this thread (server mode)
+    const FileContext* fileContext = currentFileContext();
+
+    atomic<size_t> nextJob(0);
+    bool collectStats = statsOut != nullptr;
+    auto worker = [&jobs, &nextJob, cache, fileContext, collectStats]() {
+        setFileContext(fileContext);
+        size_t idx;
+        while ((idx = nextJob++) < jobs.size())
+            runBatchJob(jobs[idx], cache, collectStats);
+    };
+
+    vector<thread> workers;
+    for (unsigned i = 0; i < nThreads; i++)
+        workers.emplace_back(worker);
+    for (auto& w: workers)
+        w.join();
+
+    int nConverted = 0;
+    for (const auto& job: jobs) {
+        if (job.ok) {
+            msg << job.params.inputFileName << " ->";
+            for (const auto& fmt: job.params.formats)
+                msg << " " << fmt.outputFileName;
+            msg << ": done." << endl;
+            ++nConverted;
         } else {
-            if (option[0] == '-') {
-                cout << "Invalid option:" << option << endl << endl;
-                usage(moduleName);
-                return 1;
-            }
+            err << job.params.inputFileName << " (" << manifestFileName << ":" << job.line << "): " << job.errorMsg << "!" << endl;
+            ++nErrors;
+        }
+    }
 
-            if (!inputFileSpecified) {
-                inputFileName = option;
-                inputFileSpecified = true;
-            } else if (!outputFileSpecified) {
-                outputFileName = option;
-                outputFileSpecified = true;
-            } else {
-                usage(moduleName);
-                return 1;
-            }
+    msg << endl << nConverted << " file(s) converted, " << nErrors << " error(s)" << endl;
+    if (cache)
+        msg << "Cache: " << cache->hits() << " hit(s), " << cache->misses() << " miss(es)" << endl;
+
+    if (statsOut) {
+        vector<const InputStats*> stats;
+        for (const auto& job: jobs)
+            stats.push_back(&job.stats);
+        writeStatsJson(*statsOut, stats, wallTimer.lap(), nThreads);
+    }
+
+    return nErrors ? 1 : 0;
+}
+
+
+// Writes all programs listed in the manifest one after another into a single tape file
+// for every format: a CAS or RKO container or, with -w, a WAV file of any tape format.
+// The inputs are read and their checksums calculated once, the tape files are not copied.
+int runContainer(const string& manifestFileName, const string& containerFileName, const ConvParams& defaultParams,
+                 ostream& msg, ostream& err)
+{
+    bool multiFormat = defaultParams.formats.size() > 1;
+
+    if (multiFormat && containerFileName == "-") {
+        err << "Several formats can't be written to stdout!" << endl;
+        return 1;
+    }
+
+    for (const auto& fmt: defaultParams.formats)
+        if (defaultParams.wav ? !TapeAudioRenderer::isSupported(fmt.format) : !isContainerFormat(fmt.format)) {
+            err << tapeFormatDesc(fmt.format).name << " format can't hold several programs" <<
+                   (defaultParams.wav ? "!" : ", use -w to write WAV!") << endl;
+            return 1;
         }
 
-        ++i;
+    vector<BatchJob> jobs;
+    int nErrors = readManifest(manifestFileName, defaultParams, jobs, err);
+    if (nErrors < 0)
+        return 1;
+
+    // the programs of a line differ by the input, addresses and names only
+    for (const auto& job: jobs) {
+        bool sameFormats = job.params.formats.size() == defaultParams.formats.size() && job.params.wav == defaultParams.wav;
+        for (size_t i = 0; sameFormats && i < job.params.formats.size(); i++)
+            sameFormats = job.params.formats[i].format == defaultParams.formats[i].format;
+        if (!sameFormats || job.params.outputFileSpecified) {
+            err << manifestFileName << ":" << job.line << ": formats and output files are set for the whole tape" << endl;
+            ++nErrors;
+        }
     }
 
-    if (!inputFileSpecified) {
-        cout << "No input file name specified!" << endl << endl;
-        usage(moduleName);
+    if (nErrors)
         return 1;
+
+    // every block of every input is a separate program on the tape
+    struct ContainerBlock {
+        const BatchJob* job;
+        MemoryBlock block;
+        uint16_t runAddr;
+        BlockChecksums cs;
+    };
+
+    vector<InputData> inputs(jobs.size());
+    vector<ContainerBlock> blocks;
+
+    for (size_t i = 0; i < jobs.size(); i++) {
+        string errorMsg;
+        if (!loadInput(jobs[i].params, inputs[i], errorMsg)) {
+            err << jobs[i].params.inputFileName << " (" << manifestFileName << ":" << jobs[i].line << "): " << errorMsg << "!" << endl;
+            return 1;
+        }
+        for (const auto& block: inputs[i].blocks)
+            blocks.push_back({&jobs[i], block, inputs[i].runAddr, calcBlockChecksums(block.data, block.size)});
     }
 
-    string inputFileNameWoPath = inputFileName.substr(inputFileName.find_last_of("/\\:") + 1);
+    msg << "Programs:" << endl;
+    for (const auto& cb: blocks)
+        msg << "\t" << cb.job->params.inputFileName << ": " << setfill('0') << setw(4) << uppercase << hex << cb.block.addr << "-" <<
+               setw(4) << cb.block.addr + cb.block.size - 1 << ", run " << setw(4) << cb.runAddr << dec << endl;
+    msg << endl;
+
+    for (const auto& fmt: defaultParams.formats) {
+        string outputFileName = containerFileName;
+        if (multiFormat || (containerFileName != "-" && containerFileName.find_last_of('.') == string::npos))
+            outputFileName = cutExtension(containerFileName) + (defaultParams.wav && multiFormat ? "." + fmt.ext : "") +
+                             (defaultParams.wav ? ".wav" : "." + fmt.ext);
+
+        vector<TapeProgram> programs(blocks.size());
+        for (size_t i = 0; i < blocks.size(); i++) {
+            const ContainerBlock& cb = blocks[i];
+            Bin2TapeOptions options = {fmt.format, cb.block.addr, cb.runAddr, cb.job->params.intFileName.c_str()};
+            bin2tapeImage(cb.block.size, cb.cs, options, programs[i].image);
+            programs[i].body = cb.block.data;
+            programs[i].bodySize = cb.block.size;
+        }
 
-    if (!intFileSpecified)
-        intFileName = inputFileNameWoPath;
+        msg << "Writing " << (outputFileName == "-" ? "stdout" : outputFileName) << " ... ";
 
-    string inputFileExt = inputFileName.substr(inputFileName.find_last_of('.') + 1);
-    if (!loadAddrSpecified && (inputFileExt == "com" || inputFileExt == "COM"))
-        loadAddr = 0x100;
+        bool ok = defaultParams.wav ?
+                    TapeAudioRenderer(fmt.format, defaultParams.sampleRate).writeWav(outputFileName, programs.data(), programs.size()) :
+                    writeTapeContainer(outputFileName, programs.data(), programs.size(), containerAlign(fmt.format));
+        if (!ok) {
+            msg << "error!" << endl;
+            err << "Error writing " << outputFileName << endl;
+            return 1;
+        }
 
-    if (!runAddrSpecified)
-        runAddr = loadAddr;
+        msg << "done." << endl;
+    }
 
-    if (!outputFileSpecified)
-        outputFileName = inputFileNameWoPath.substr(0, inputFileNameWoPath.find_last_of('.')) + "." + ext;
+    msg << endl << blocks.size() << " program(s) on tape" << endl;
 
-    const uint8_t* intFileNameBuf = nullptr;
-    int intFileNameLen = 0;
+    return 0;
+}
 
-    if (format == TFF_BRU || format == TFF_RKO)
-        intFileNameLen = 8;
-    else if (format == TFF_CAS || format == TFF_LVT)
-        intFileNameLen = 6;
 
-    if (intFileNameLen)
-        intFileNameBuf = makeIntName(intFileName, intFileNameLen);
+// Estimated time of loading a block from tape in seconds, 0 for non-tape formats
+static double tapeLoadTime(TapeFileFormat format, size_t bodySize)
+{
+    if (!TapeAudioRenderer::isSupported(format))
+        return 0;
+
+    Bin2TapeOptions options = {format, 0, 0, ""};
+    TapeImage image;
+    bin2tapeImage(bodySize, BlockChecksums(), options, image);
 
-    vector<uint8_t> body;
-    if (!loadFile(inputFileName, body)) {
-        cout << "Input file error" << endl;
+    return TapeAudioRenderer(format).playTime(image, bodySize);
+}
+
+
+// m:ss
+static string formatTime(double secs)
+{
+    unsigned totalSecs = unsigned(secs + 0.5);
+    ostringstream str;
+    str << totalSecs / 60 << ":" << setfill('0') << setw(2) << totalSecs % 60;
+    return str.str();
+}
+
+
+// Options that are not passed to parseArgs
+struct CommandLine {
+    vector<string> convArgs;
+    string manifestFileName;
+    string cacheDir;
+    string verifyDir;
+    string containerFileName;
+    unsigned nThreads = 0;
+    bool quiet = false;
+    bool statsJson = false;
+    bool invalidThreads = false;
+};
+
+
+void parseCommandLine(const vector<string>& args, CommandLine& cmd)
+{
+    for (size_t i = 0; i < args.size(); i++) {
+        const string& option = args[i];
+
+        if ((option == "-b" || option == "-j" || option == "-c" || option == "--verify" || option == "--tape") && i + 1 < args.size()) {
+            ++i;
+            if (option == "-b")
+                cmd.manifestFileName = args[i];
+            else if (option == "--tape")
+                cmd.containerFileName = args[i];
+            else if (option == "--verify")
+                cmd.verifyDir = args[i];
+            else if (option == "-c")
+                cmd.cacheDir = args[i];
+            else {
+                char* numEnd;
+                cmd.nThreads = strtoul(args[i].c_str(), &numEnd, 10);
+                cmd.invalidThreads = *numEnd != '\0';
+            }
+        } else if (option == "-q")
+            cmd.quiet = true;
+        else if (option == "--stats=json")
+            cmd.statsJson = true;
+        else
+            cmd.convArgs.push_back(option);
+    }
+}
+
+
+const char* banner = "bin2tape v. " VERSION " (c) Viktor Pykhonin, 2021-2023";
+
+
+// Runs the conversion given by the command line, out and errOut stand for stdout and stderr
+int runCommandLine(const vector<string>& cmdArgs, string& moduleName, ostream& out, ostream& errOut)
+{
+    // parse command line
+
+    if (cmdArgs.empty()) {
+        out << banner << endl << endl;
+        usage(moduleName, out);
         return 1;
     }
 
-    cout << "Processing " << inputFileName << ":" << endl;
-    cout << "\tFormat:\t\t" << txtFormats[format] << endl;
-    cout << "\tLoad address:\t" << setfill('0') << setw(4) << uppercase << hex << loadAddr << endl;
-    cout << "\tEnd address:\t" << setfill('0') << setw(4) << uppercase << hex << loadAddr + body.size() - 1 << endl;
-    if (format == TFF_CAS || format == TFF_LVT)
-        cout << "\tRun address:\t" << setfill('0') << setw(4) << uppercase << hex << runAddr << endl;
-    if (format == TFF_CAS || format == TFF_LVT || format == TFF_BRU || format == TFF_RKO) {
-        cout << "\tInt. file name:\t";
-        for (int i = 0; i < intFileNameLen; i++)
-            cout << char(intFileNameBuf[i]);
-        cout << endl;
+    CommandLine cmd;
+    parseCommandLine(cmdArgs, cmd);
+
+    const vector<string>& args = cmd.convArgs;
+    const string& manifestFileName = cmd.manifestFileName;
+    const string& cacheDir = cmd.cacheDir;
+    unsigned nThreads = cmd.nThreads;
+    bool quiet = cmd.quiet;
+    bool invalidThreads = cmd.invalidThreads;
+
+    ConvParams params;
+    string errorMsg;
+
+    bool argsOk = parseArgs(args, params, errorMsg);
+
+    // keep stdout clean when the tape image is written there
+    bool toStdout = params.outputFileName == "-" || cmd.containerFileName == "-" || (params.inputFileName == "-" && !params.outputFileSpecified && params.formats.size() == 1);
+    ostream nullStream(nullptr);
+    ostream& err = toStdout || cmd.statsJson ? errOut : out;
+    ostream& msg = quiet || cmd.statsJson ? nullStream : err;
+    // the statistics replace the messages
+    ostream& statsOut = toStdout ? errOut : out;
+    ostream* statsPtr = cmd.statsJson ? &statsOut : nullptr;
+
+    msg << banner << endl << endl;
+
+    if (invalidThreads) {
+        err << "Invalid number of threads!" << endl << endl;
+        usage(moduleName, err);
+        return 1;
     }
 
-    cout << endl;
+    if (!cmd.verifyDir.empty()) {
+        if (!args.empty() || !manifestFileName.empty() || !cacheDir.empty()) {
+            usage(moduleName, err);
+            return 1;
+        }
+        return verifyTapeArchive(cmd.verifyDir, nThreads, msg, err);
+    }
 
-    cout << "Writing " << outputFileName << " ... ";
+    if (!argsOk) {
+        if (!errorMsg.empty())
+            err << errorMsg << endl << endl;
+        usage(moduleName, err);
+        return 1;
+    }
 
-    if (!convert(body, format, loadAddr, runAddr, outputFileName, intFileNameBuf)) {
-        cout << "error!" << endl;
+    ConversionCache cache;
+    if (!cacheDir.empty() && !cache.open(cacheDir)) {
+        err << "Can't open cache directory " << cacheDir << endl;
         return 1;
     }
+    ConversionCache* cachePtr = cacheDir.empty() ? nullptr : &cache;
 
-    cout << "done." << endl;
+    if (!cmd.containerFileName.empty()) {
+        if (manifestFileName.empty() || params.inputFileSpecified || !params.segments.empty() || cachePtr) {
+            usage(moduleName, err);
+            return 1;
+        }
+        // the programs share one output file, so there are no per-file statistics
+        if (cmd.statsJson) {
+            err << "--stats=json can't be used with --tape!" << endl;
+            return 1;
+        }
+        return runContainer(manifestFileName, cmd.containerFileName, params, msg, err);
+    }
 
-    return 0;
+    if (!manifestFileName.empty()) {
+        if (params.inputFileSpecified || !params.segments.empty()) {
+            usage(moduleName, err);
+            return 1;
+        }
+        return runBatch(manifestFileName, params, nThreads, cachePtr, msg, err, statsPtr);
+    }
+
+    if (!params.inputFileSpecified && params.segments.empty()) {
+        err << "No input file name specified!" << endl << endl;
+        usage(moduleName, err);
+        return 1;
+    }
+
+    if (!completeParams(params, errorMsg)) {
+        err << errorMsg << endl;
+        return 1;
+    }
+
+    StatsTimer wallTimer;
+    InputStats stats;
+    InputStats* inputStats = statsPtr ? &stats : nullptr;
+
+    InputData input;
+    if (!loadInput(params, input, errorMsg, inputStats)) {
+        if (params.segments.empty()) // otherwise the message starts with the file name
+            errorMsg[0] = toupper(errorMsg[0]);
+        err << errorMsg << endl;
+        if (statsPtr) {
+            stats.errorMsg = errorMsg;
+            writeStatsJson(*statsPtr, {&stats}, wallTimer.lap(), 1);
+        }
+        return 1;
+    }
+
+    bool hasRunAddr = false;
+    int intFileNameLen = 0;
+    string formatNames;
+    for (const auto& fmt: params.formats) {
+        hasRunAddr = hasRunAddr || tapeFormatDesc(fmt.format).hasRunAddr;
+        intFileNameLen = max(intFileNameLen, intFileNameLength(fmt.format));
+        formatNames += (formatNames.empty() ? "" : ", ") + string(tapeFormatDesc(fmt.format).name);
+    }
+
+    uint8_t intFileNameBuf[8];
+    if (intFileNameLen)
+        makeIntName(params.intFileName, intFileNameLen, intFileNameBuf);
+
+    msg << "Processing " << (params.inputFileName == "-" ? "stdin" : params.inputFileName) << ":" << endl;
+    msg << "\tFormat:\t\t" << formatNames << endl;
+    if (input.blocks.size() == 1) {
+        msg << "\tLoad address:\t" << setfill('0') << setw(4) << uppercase << hex << input.blocks[0].addr << endl;
+        msg << "\tEnd address:\t" << setfill('0') << setw(4) << uppercase << hex << input.blocks[0].addr + input.blocks[0].size - 1 << endl;
+    } else {
+        msg << "\tBlocks:\t\t";
+        for (const auto& block: input.blocks)
+            msg << (&block == &input.blocks[0] ? "" : ", ") << setfill('0') << setw(4) << uppercase << hex << block.addr << "-" <<
+                   setw(4) << block.addr + block.size - 1;
+        msg << endl;
+    }
+    if (hasRunAddr)
+        msg << "\tRun address:\t" << setfill('0') << setw(4) << uppercase << hex << input.runAddr << endl;
+    if (intFileNameLen) {
+        msg << "\tInt. file name:\t";
+        for (int i = 0; i < intFileNameLen; i++)
+            msg << char(intFileNameBuf[i]);
+        msg << endl;
+    }
+
+    if (params.pack) {
+        const MemoryBlock& unpacked = input.unpackedBlock;
+        size_t packedSize = input.packed.data.size();
+        msg << "\tUnpacks to:\t" << setfill('0') << setw(4) << uppercase << hex << unpacked.addr << "-" <<
+               setw(4) << unpacked.addr + unpacked.size - 1 << ", run " << setw(4) << input.unpackedRunAddr << endl;
+        msg << "\tPacked size:\t" << dec << packedSize << " of " << unpacked.size << " bytes (" <<
+               (unpacked.size ? packedSize * 100 / unpacked.size : 0) << "%)" << endl;
+        for (const auto& fmt: params.formats) {
+            double unpackedTime = tapeLoadTime(fmt.format, unpacked.size);
+            double packedTime = tapeLoadTime(fmt.format, packedSize);
+            if (unpackedTime > 0)
+                msg << "\tLoad time:\t" << tapeFormatDesc(fmt.format).name << " " << formatTime(unpackedTime) << " -> " <<
+                       formatTime(packedTime) << (packedTime < unpackedTime ? " (saves " + formatTime(unpackedTime - packedTime) + ")" : "") << endl;
+        }
+    }
+
+    msg << endl;
+
+    stats.ok = convertInput(input, params, cachePtr, msg, errorMsg, inputStats);
+    if (!stats.ok) {
+        string message = errorMsg;
+        message[0] = toupper(message[0]);
+        err << message << endl;
+    }
+
+    if (stats.ok && cachePtr)
+        msg << endl << "Cache: " << cache.hits() << " hit(s), " << cache.misses() << " miss(es)" << endl;
+
+    if (statsPtr) {
+        stats.errorMsg = stats.ok ? "" : errorMsg;
+        writeStatsJson(*statsPtr, {&stats}, wallTimer.lap(), 1);
+    }
+
+    return stats.ok ? 0 : 1;
+}
+
+
+// true if the conversion reads stdin, so that the client sends it to the server
+bool readsStdin(const vector<string>& args)
+{
+    CommandLine cmd;
+    parseCommandLine(args, cmd);
+
+    ConvParams params;
+    string errorMsg;
+    return cmd.manifestFileName == "-" || (parseArgs(cmd.convArgs, params, errorMsg) && params.inputFileName == "-");
+}
+
+
+int main(int argc, const char** argv)
+{
+    static_assert(sizeof(RkFooter) == 5, "Packed structs required!");
+
+    string moduleName = argv[0];
+    moduleName = moduleName.substr(moduleName.find_last_of("/\\:") + 1);
+
+    vector<string> args(argv + 1, argv + argc);
+
+    if (!args.empty() && args[0] == "--serve") {
+        CommandLine cmd;
+        parseCommandLine(vector<string>(args.begin() + 1, args.end()), cmd);
+        if (cmd.convArgs.size() != 1 || cmd.invalidThreads || !cmd.manifestFileName.empty() || !cmd.cacheDir.empty()) {
+            cout << banner << endl << endl;
+            usage(moduleName);
+            return 1;
+        }
+
+        ostream nullStream(nullptr);
+        ostream& msg = cmd.quiet ? nullStream : cout;
+        msg << banner << endl << endl;
+
+        auto handler = [&moduleName](const vector<string>& requestArgs, ostream& out, ostream& err) {
+            return runCommandLine(requestArgs, moduleName, out, err);
+        };
+        return runServer(cmd.convArgs[0], cmd.nThreads, handler, msg);
+    }
+
+    // client mode: --connect always uses the server, BIN2TAPE_SERVER only if it is running
+    string socketName;
+    bool serverRequired = false;
+    if (args.size() >= 2 && args[0] == "--connect") {
+        socketName = args[1];
+        args.erase(args.begin(), args.begin() + 2);
+        serverRequired = true;
+    } else if (const char* envSocket = getenv("BIN2TAPE_SERVER"))
+        socketName = envSocket;
+
+    if (!socketName.empty()) {
+        int res = runClient(socketName, args, readsStdin(args));
+        if (res >= 0)
+            return res;
+        if (serverRequired) {
+            cerr << "Can't connect to the server at " << socketName << endl;
+            return 1;
+        }
+    }
+
+    return runCommandLine(args, moduleName, cout, cerr);
 }
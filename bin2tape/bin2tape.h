@@ -48,9 +48,6 @@ enum TapeFileFormat {
 };
 
 
-const char* txtFormats[] = {"RK compatible", "RKP (RK compatible)", "RKM", "RKU", "RK4 (RK compatible)", "RKS", "RKO", "BRU", "CAS", "LVT"};
-
-
 #pragma pack(push, 1)
 
 struct RkHeader {
@@ -4,9 +4,34 @@ CONFIG -= app_bundle
 CONFIG -= qt
 
 SOURCES += \
-    bin2tape.cpp
+    bin2tape.cpp \
+    checksum.cpp \
+    fileio.cpp \
+    tapeformat.cpp \
+    tapeaudio.cpp \
+    convcache.cpp \
+    libbin2tape.cpp \
+    memmap.cpp \
+    server.cpp \
+    verify.cpp \
+    lzpack.cpp \
+    stats.cpp
 
 HEADERS += \
-    bin2tape.h
+    bin2tape.h \
+    checksum.h \
+    fileio.h \
+    tapeformat.h \
+    tapeaudio.h \
+    convcache.h \
+    libbin2tape.h \
+    memmap.h \
+    server.h \
+    verify.h \
+    lzpack.h \
+    stats.h
+
+QMAKE_CXXFLAGS += -pthread
+LIBS += -pthread
 
 QMAKE_LFLAGS += -static -static-libgcc
@@ -0,0 +1,407 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#include <cstring>
+
+#include "checksum.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CS_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+// Reference implementation
+
+static uint32_t byteSumByte(const uint8_t* data, size_t len)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < len; i++)
+        sum += data[i];
+    return sum;
+}
+
+
+static uint16_t wordXorByte(const uint8_t* data, size_t len)
+{
+    uint16_t cs = 0;
+    for (size_t i = 0; i < len; i++)
+        cs ^= i & 1 ? data[i] << 8 : data[i];
+    return cs;
+}
+
+
+static uint16_t sumAndXorByte(const uint8_t* data, size_t len, uint32_t& sum)
+{
+    sum = byteSumByte(data, len);
+    return wordXorByte(data, len);
+}
+
+
+// 64-bit word at a time
+
+static uint32_t byteSumWord(const uint8_t* data, size_t len)
+{
+    const uint64_t mask = 0x00FF00FF00FF00FFull;
+
+    uint32_t sum = 0;
+
+    while (len >= 8) {
+        // each of the four 16-bit lanes grows by at most 2 * 255 per word
+        size_t nWords = len / 8;
+        if (nWords > 128)
+            nWords = 128;
+        len -= nWords * 8;
+
+        uint64_t acc = 0;
+        for (size_t i = 0; i < nWords; i++) {
+            uint64_t w;
+            memcpy(&w, data, 8);
+            data += 8;
+            acc += (w & mask) + ((w >> 8) & mask);
+        }
+
+        acc = (acc & 0x0000FFFF0000FFFFull) + ((acc >> 16) & 0x0000FFFF0000FFFFull);
+        sum += uint32_t(acc) + uint32_t(acc >> 32);
+    }
+
+    return sum + byteSumByte(data, len);
+}
+
+
+// Folds the XOR of 16-bit little endian words accumulated in a 32-bit value in native byte order
+static uint16_t foldWordXor(uint32_t acc)
+{
+    uint16_t cs = acc ^ (acc >> 16);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    cs = (cs >> 8) | (cs << 8);
+#endif
+    return cs;
+}
+
+
+static uint16_t wordXorWord(const uint8_t* data, size_t len)
+{
+    uint64_t acc = 0;
+
+    for (; len >= 8; len -= 8, data += 8) {
+        uint64_t w;
+        memcpy(&w, data, 8);
+        acc ^= w;
+    }
+
+    // the rest starts at an even offset, so the byte order of words is preserved
+    return foldWordXor(uint32_t(acc) ^ uint32_t(acc >> 32)) ^ wordXorByte(data, len);
+}
+
+
+static uint16_t sumAndXorWord(const uint8_t* data, size_t len, uint32_t& sum)
+{
+    const uint64_t mask = 0x00FF00FF00FF00FFull;
+
+    uint64_t xorAcc = 0;
+    sum = 0;
+
+    while (len >= 8) {
+        size_t nWords = len / 8;
+        if (nWords > 128)
+            nWords = 128;
+        len -= nWords * 8;
+
+        uint64_t acc = 0;
+        for (size_t i = 0; i < nWords; i++) {
+            uint64_t w;
+            memcpy(&w, data, 8);
+            data += 8;
+            acc += (w & mask) + ((w >> 8) & mask);
+            xorAcc ^= w;
+        }
+
+        acc = (acc & 0x0000FFFF0000FFFFull) + ((acc >> 16) & 0x0000FFFF0000FFFFull);
+        sum += uint32_t(acc) + uint32_t(acc >> 32);
+    }
+
+    sum += byteSumByte(data, len);
+    return foldWordXor(uint32_t(xorAcc) ^ uint32_t(xorAcc >> 32)) ^ wordXorByte(data, len);
+}
+
+
+#ifdef CS_X86_KERNELS
+
+// SSE2
+
+__attribute__((target("sse2")))
+static uint32_t byteSumSse2(const uint8_t* data, size_t len)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i acc0 = zero;
+    __m128i acc1 = zero;
+
+    for (; len >= 32; len -= 32, data += 32) {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+        acc0 = _mm_add_epi64(acc0, _mm_sad_epu8(v0, zero));
+        acc1 = _mm_add_epi64(acc1, _mm_sad_epu8(v1, zero));
+    }
+
+    acc0 = _mm_add_epi64(acc0, acc1);
+    uint32_t sum = _mm_cvtsi128_si32(acc0) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc0, acc0));
+
+    return sum + byteSumWord(data, len);
+}
+
+
+__attribute__((target("sse2")))
+static uint16_t foldWordXorSse2(__m128i acc)
+{
+    acc = _mm_xor_si128(acc, _mm_srli_si128(acc, 8));
+    acc = _mm_xor_si128(acc, _mm_srli_si128(acc, 4));
+    return foldWordXor(_mm_cvtsi128_si32(acc));
+}
+
+
+__attribute__((target("sse2")))
+static uint16_t wordXorSse2(const uint8_t* data, size_t len)
+{
+    __m128i acc0 = _mm_setzero_si128();
+    __m128i acc1 = _mm_setzero_si128();
+
+    for (; len >= 32; len -= 32, data += 32) {
+        acc0 = _mm_xor_si128(acc0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data)));
+        acc1 = _mm_xor_si128(acc1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)));
+    }
+
+    return foldWordXorSse2(_mm_xor_si128(acc0, acc1)) ^ wordXorWord(data, len);
+}
+
+
+__attribute__((target("sse2")))
+static uint16_t sumAndXorSse2(const uint8_t* data, size_t len, uint32_t& sum)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    __m128i sumAcc0 = zero;
+    __m128i sumAcc1 = zero;
+    __m128i xorAcc0 = zero;
+    __m128i xorAcc1 = zero;
+
+    for (; len >= 32; len -= 32, data += 32) {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16));
+        sumAcc0 = _mm_add_epi64(sumAcc0, _mm_sad_epu8(v0, zero));
+        sumAcc1 = _mm_add_epi64(sumAcc1, _mm_sad_epu8(v1, zero));
+        xorAcc0 = _mm_xor_si128(xorAcc0, v0);
+        xorAcc1 = _mm_xor_si128(xorAcc1, v1);
+    }
+
+    sumAcc0 = _mm_add_epi64(sumAcc0, sumAcc1);
+    uint32_t tailSum;
+    uint16_t tailXor = sumAndXorWord(data, len, tailSum);
+    sum = _mm_cvtsi128_si32(sumAcc0) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sumAcc0, sumAcc0)) + tailSum;
+
+    return foldWordXorSse2(_mm_xor_si128(xorAcc0, xorAcc1)) ^ tailXor;
+}
+
+
+// AVX2
+
+__attribute__((target("avx2")))
+static uint32_t byteSumAvx2(const uint8_t* data, size_t len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i acc0 = zero;
+    __m256i acc1 = zero;
+
+    for (; len >= 64; len -= 64, data += 64) {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 32));
+        acc0 = _mm256_add_epi64(acc0, _mm256_sad_epu8(v0, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_sad_epu8(v1, zero));
+    }
+
+    acc0 = _mm256_add_epi64(acc0, acc1);
+    __m128i acc = _mm_add_epi64(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1));
+    uint32_t sum = _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc));
+
+    // the tail is summed with the legacy SSE code, which is slow while the upper halves are dirty
+    _mm256_zeroupper();
+
+    return sum + byteSumSse2(data, len);
+}
+
+
+__attribute__((target("avx2")))
+static uint16_t wordXorAvx2(const uint8_t* data, size_t len)
+{
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+
+    for (; len >= 64; len -= 64, data += 64) {
+        acc0 = _mm256_xor_si256(acc0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data)));
+        acc1 = _mm256_xor_si256(acc1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 32)));
+    }
+
+    acc0 = _mm256_xor_si256(acc0, acc1);
+    __m128i acc = _mm_xor_si128(_mm256_castsi256_si128(acc0), _mm256_extracti128_si256(acc0, 1));
+    _mm256_zeroupper();
+
+    return foldWordXorSse2(acc) ^ wordXorSse2(data, len);
+}
+
+__attribute__((target("avx2")))
+static uint16_t sumAndXorAvx2(const uint8_t* data, size_t len, uint32_t& sum)
+{
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i sumAcc0 = zero;
+    __m256i sumAcc1 = zero;
+    __m256i xorAcc0 = zero;
+    __m256i xorAcc1 = zero;
+
+    for (; len >= 64; len -= 64, data += 64) {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 32));
+        sumAcc0 = _mm256_add_epi64(sumAcc0, _mm256_sad_epu8(v0, zero));
+        sumAcc1 = _mm256_add_epi64(sumAcc1, _mm256_sad_epu8(v1, zero));
+        xorAcc0 = _mm256_xor_si256(xorAcc0, v0);
+        xorAcc1 = _mm256_xor_si256(xorAcc1, v1);
+    }
+
+    sumAcc0 = _mm256_add_epi64(sumAcc0, sumAcc1);
+    __m128i sumAcc = _mm_add_epi64(_mm256_castsi256_si128(sumAcc0), _mm256_extracti128_si256(sumAcc0, 1));
+    xorAcc0 = _mm256_xor_si256(xorAcc0, xorAcc1);
+    __m128i xorAcc = _mm_xor_si128(_mm256_castsi256_si128(xorAcc0), _mm256_extracti128_si256(xorAcc0, 1));
+    _mm256_zeroupper();
+
+    uint32_t tailSum;
+    uint16_t tailXor = sumAndXorSse2(data, len, tailSum);
+    sum = _mm_cvtsi128_si32(sumAcc) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sumAcc, sumAcc)) + tailSum;
+
+    return foldWordXorSse2(xorAcc) ^ tailXor;
+}
+
+#endif // CS_X86_KERNELS
+
+
+static const ChecksumKernels c_byteKernels = {"byte", byteSumByte, wordXorByte, sumAndXorByte};
+static const ChecksumKernels c_wordKernels = {"word", byteSumWord, wordXorWord, sumAndXorWord};
+#ifdef CS_X86_KERNELS
+static const ChecksumKernels c_sse2Kernels = {"sse2", byteSumSse2, wordXorSse2, sumAndXorSse2};
+static const ChecksumKernels c_avx2Kernels = {"avx2", byteSumAvx2, wordXorAvx2, sumAndXorAvx2};
+#endif
+
+
+const ChecksumKernels* getChecksumKernels(ChecksumImpl impl)
+{
+    switch (impl) {
+    case CSI_BYTE:
+        return &c_byteKernels;
+    case CSI_WORD:
+        return &c_wordKernels;
+#ifdef CS_X86_KERNELS
+    case CSI_SSE2:
+        return __builtin_cpu_supports("sse2") ? &c_sse2Kernels : nullptr;
+    case CSI_AVX2:
+        return __builtin_cpu_supports("avx2") ? &c_avx2Kernels : nullptr;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+
+static const ChecksumKernels* selectChecksumKernels()
+{
+    for (int impl = CSI_COUNT - 1; impl > CSI_BYTE; impl--)
+        if (const ChecksumKernels* kernels = getChecksumKernels(ChecksumImpl(impl)))
+            return kernels;
+    return &c_byteKernels;
+}
+
+
+const ChecksumKernels* getBestChecksumKernels()
+{
+    static const ChecksumKernels* kernels = selectChecksumKernels();
+    return kernels;
+}
+
+
+uint16_t addToRkCs(uint16_t baseCs, const uint8_t* data, size_t len, bool lastChunk)
+{
+    if (!len)
+        return baseCs;
+
+    if (lastChunk)
+        --len;
+
+    // cs += data[i] + (data[i] << 8) for every byte is the same as cs += sum * 257 (mod 0x10000)
+    baseCs += uint16_t(getBestChecksumKernels()->byteSum(data, len) * 257);
+
+    if (lastChunk)
+        baseCs = (baseCs & 0xff00) | ((baseCs + data[len]) & 0xff);
+
+    return baseCs;
+}
+
+
+uint16_t calcRkCs(const uint8_t* data, size_t len)
+{
+    return addToRkCs(0, data, len, true);
+}
+
+
+uint16_t calcRkmCs(const uint8_t* data, size_t len)
+{
+    return getBestChecksumKernels()->wordXor(data, len);
+}
+
+
+uint16_t calcRkuCs(const uint8_t* data, size_t len)
+{
+    return uint16_t(getBestChecksumKernels()->byteSum(data, len));
+}
+
+
+BlockChecksums calcBlockChecksums(const uint8_t* data, size_t len)
+{
+    BlockChecksums cs;
+
+    cs.rkmCs = getBestChecksumKernels()->sumAndXor(data, len, cs.byteSum);
+    cs.rkuCs = uint16_t(cs.byteSum);
+
+    // the last byte is added to the low byte only
+    if (len) {
+        uint8_t lastByte = data[len - 1];
+        cs.rkCs = uint16_t((cs.byteSum - lastByte) * 257);
+        cs.rkCs = (cs.rkCs & 0xff00) | ((cs.rkCs + lastByte) & 0xff);
+    } else
+        cs.rkCs = 0;
+
+    return cs;
+}
+
+
+uint16_t addToRkCs(uint16_t baseCs, const BlockChecksums& blockCs)
+{
+    return baseCs + uint16_t(blockCs.byteSum * 257);
+}
@@ -0,0 +1,80 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <cstdint>
+#include <cstddef>
+
+
+// Tape checksums.
+//
+// All of them reduce to two primitives over the data block:
+//   - the plain sum of all bytes (RK: cs += b + (b << 8), i. e. cs += b * 257; RKU: cs += b);
+//   - XOR of the block taken as little endian 16-bit words (RKM).
+// The primitives are implemented by several kernels, the fastest one supported by the CPU
+// is selected at run time.
+
+uint16_t addToRkCs(uint16_t baseCs, const uint8_t* data, size_t len, bool lastChunk = false);
+uint16_t calcRkCs(const uint8_t* data, size_t len);
+uint16_t calcRkmCs(const uint8_t* data, size_t len);
+uint16_t calcRkuCs(const uint8_t* data, size_t len);
+
+
+// All checksum variants of a block computed in a single pass over the data
+struct BlockChecksums {
+    uint32_t byteSum;
+    uint16_t rkCs;
+    uint16_t rkmCs;
+    uint16_t rkuCs;
+};
+
+BlockChecksums calcBlockChecksums(const uint8_t* data, size_t len);
+
+// same as addToRkCs(baseCs, data, len) for the block
+uint16_t addToRkCs(uint16_t baseCs, const BlockChecksums& blockCs);
+
+
+enum ChecksumImpl {
+    CSI_BYTE,   // reference byte by byte loops
+    CSI_WORD,   // 64-bit word at a time (SWAR)
+    CSI_SSE2,
+    CSI_AVX2,
+    CSI_COUNT
+};
+
+
+struct ChecksumKernels {
+    const char* name;
+    uint32_t (*byteSum)(const uint8_t* data, size_t len);
+    uint16_t (*wordXor)(const uint8_t* data, size_t len);
+    uint16_t (*sumAndXor)(const uint8_t* data, size_t len, uint32_t& sum); // both of the above, returns XOR
+};
+
+
+// returns nullptr if the implementation is not supported by the CPU or the compiler
+const ChecksumKernels* getChecksumKernels(ChecksumImpl impl);
+
+// the fastest supported implementation
+const ChecksumKernels* getBestChecksumKernels();
+
+#endif // CHECKSUM_H
@@ -0,0 +1,203 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#include <cstring>
+#include <cstdio>
+
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__)
+#define CONVCACHE_POSIX
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+#else
+#include <direct.h>
+#include <process.h>
+#endif
+
+#include "convcache.h"
+#include "fileio.h"
+
+using namespace std;
+
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+
+// final mix of MurmurHash3
+static inline uint64_t fmix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+CacheKeyBuilder::CacheKeyBuilder()
+{
+    m_hash[0] = 0x9E3779B97F4A7C15ULL;
+    m_hash[1] = 0x6A09E667F3BCC909ULL;
+}
+
+
+// Two independent 64-bit lanes over 8-byte words, the tail is padded with zeros and the length is mixed in
+void CacheKeyBuilder::add(const void* data, size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint64_t h0 = m_hash[0];
+    uint64_t h1 = m_hash[1];
+
+    for (size_t left = size; left; ) {
+        uint64_t w = 0;
+        size_t len = left < 8 ? left : 8;
+        memcpy(&w, p, len);
+        p += len;
+        left -= len;
+
+        h0 = rotl64(h0 ^ (w * 0x87C37B91114253D5ULL), 31) * 0x4CF5AD432745937FULL;
+        h1 = rotl64(h1 ^ (w * 0x4CF5AD432745937FULL), 33) * 0x87C37B91114253D5ULL + h0;
+    }
+
+    m_hash[0] = h0 ^ size;
+    m_hash[1] = h1 + size;
+}
+
+
+CacheKey CacheKeyBuilder::key() const
+{
+    CacheKey key;
+    key.hash[0] = fmix64(m_hash[0] + m_hash[1]);
+    key.hash[1] = fmix64(m_hash[1] ^ key.hash[0]);
+    return key;
+}
+
+
+string CacheKey::str() const
+{
+    char buf[33];
+    snprintf(buf, sizeof(buf), "%016llx%016llx", (unsigned long long)hash[0], (unsigned long long)hash[1]);
+    return buf;
+}
+
+
+bool ConversionCache::open(const string& cacheDir)
+{
+    string dir = resolvePath(cacheDir);
+    m_dir = dir;
+    if (!m_dir.empty() && m_dir.back() != '/' && m_dir.back() != '\\')
+        m_dir += '/';
+
+#ifdef CONVCACHE_POSIX
+    if (mkdir(dir.c_str(), 0777) && errno != EEXIST)
+        return false;
+    struct stat st;
+    return stat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+#else
+    _mkdir(dir.c_str());
+    struct _stat st;
+    return _stat(dir.c_str(), &st) == 0 && (st.st_mode & _S_IFDIR);
+#endif
+}
+
+
+string ConversionCache::entryFileName(const CacheKey& key) const
+{
+    return m_dir + key.str();
+}
+
+
+// shared by all cache instances of the process (server mode requests use separate instances)
+static atomic<unsigned> tempCounter(0);
+
+
+string ConversionCache::tempFileName(const CacheKey& key)
+{
+#ifdef CONVCACHE_POSIX
+    unsigned pid = getpid();
+#else
+    unsigned pid = _getpid();
+#endif
+    return entryFileName(key) + ".tmp" + to_string(pid) + "-" + to_string(tempCounter++);
+}
+
+
+// Links the cache entry to the output file, copies it if linking is not possible (stdout, other file system)
+bool ConversionCache::place(const string& entryFile, const string& outputFile)
+{
+#ifdef CONVCACHE_POSIX
+    if (outputFile != "-") {
+        string outputPath = resolvePath(outputFile);
+        unlink(outputPath.c_str());
+        if (link(entryFile.c_str(), outputPath.c_str()) == 0)
+            return true;
+    }
+#endif
+
+    InputFile entry;
+    if (!entry.open(entryFile, size_t(-1)))
+        return false;
+
+    OutputChunk chunk = {entry.data(), entry.size()};
+    return writeChunks(outputFile, &chunk, 1);
+}
+
+
+bool ConversionCache::lookup(const CacheKey& key, const string& outputFile)
+{
+    string entryFile = entryFileName(key);
+
+#ifdef CONVCACHE_POSIX
+    bool exists = access(entryFile.c_str(), R_OK) == 0;
+#else
+    struct _stat st;
+    bool exists = _stat(entryFile.c_str(), &st) == 0;
+#endif
+
+    if (exists && place(entryFile, outputFile)) {
+        ++m_hits;
+        return true;
+    }
+
+    ++m_misses;
+    return false;
+}
+
+
+bool ConversionCache::insert(const CacheKey& key, const string& tempFile, const string& outputFile)
+{
+    string entryFile = entryFileName(key);
+
+    // rename is atomic, so concurrent conversions of the same input never see a partial entry
+#ifndef CONVCACHE_POSIX
+    remove(entryFile.c_str());
+#endif
+    if (rename(tempFile.c_str(), entryFile.c_str())) {
+        remove(tempFile.c_str());
+        return false;
+    }
+
+    return place(entryFile, outputFile);
+}
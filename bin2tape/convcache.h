@@ -0,0 +1,84 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#ifndef CONVCACHE_H
+#define CONVCACHE_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+#include <atomic>
+
+
+// 128-bit hash of the input data and all conversion parameters
+struct CacheKey {
+    uint64_t hash[2];
+
+    std::string str() const;
+};
+
+
+class CacheKeyBuilder
+{
+public:
+    CacheKeyBuilder();
+
+    void add(const void* data, size_t size);
+    template <typename T> void add(const T& value) {add(&value, sizeof(value));}
+
+    CacheKey key() const;
+
+private:
+    uint64_t m_hash[2];
+};
+
+
+// Conversion cache: the output files are stored in the cache directory under the hash of the input
+// and the parameters. On a hit the cached file is hard linked to the output file (or copied
+// if linking fails), so the conversion is skipped.
+class ConversionCache
+{
+public:
+    bool open(const std::string& dir); // creates the directory if needed
+
+    // on hit places the cached file at outputFile ("-" for stdout), counts hits and misses
+    bool lookup(const CacheKey& key, const std::string& outputFile);
+
+    // a unique temporary file name in the cache directory to write the conversion result to
+    std::string tempFileName(const CacheKey& key);
+
+    // moves the temporary file into the cache and places it at outputFile
+    bool insert(const CacheKey& key, const std::string& tempFile, const std::string& outputFile);
+
+    unsigned hits() const {return m_hits;}
+    unsigned misses() const {return m_misses;}
+
+private:
+    std::string m_dir;
+    std::atomic<unsigned> m_hits {0};
+    std::atomic<unsigned> m_misses {0};
+
+    std::string entryFileName(const CacheKey& key) const;
+    bool place(const std::string& entryFile, const std::string& outputFile);
+};
+
+#endif // CONVCACHE_H
@@ -0,0 +1,528 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#include <fstream>
+#include <mutex>
+#include <algorithm>
+
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__)
+#define FILEIO_POSIX
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#else
+#include <cstdio>
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "fileio.h"
+#include "tapeformat.h"
+
+using namespace std;
+
+
+string cutExtension(const string& fileName)
+{
+    size_t periodPos = fileName.find_last_of('.');
+    size_t pathEnd = fileName.find_last_of("/\\:");
+    if (periodPos == string::npos || (pathEnd != string::npos && periodPos < pathEnd))
+        return fileName;
+    return fileName.substr(0, periodPos);
+}
+
+
+static thread_local const FileContext* threadFileContext = nullptr;
+
+
+void setFileContext(const FileContext* context)
+{
+    threadFileContext = context;
+}
+
+
+const FileContext* currentFileContext()
+{
+    return threadFileContext;
+}
+
+
+static bool isAbsolutePath(const string& fileName)
+{
+#ifdef FILEIO_POSIX
+    return !fileName.empty() && fileName[0] == '/';
+#else
+    return (!fileName.empty() && (fileName[0] == '/' || fileName[0] == '\\')) || (fileName.size() > 1 && fileName[1] == ':');
+#endif
+}
+
+
+string resolvePath(const string& fileName)
+{
+    if (!threadFileContext || threadFileContext->workDir.empty() || fileName == "-" || isAbsolutePath(fileName))
+        return fileName;
+    return threadFileContext->workDir + "/" + fileName;
+}
+
+
+// stdin replaced by the file context
+static bool openStdinData(size_t maxSize, const uint8_t*& data, size_t& size)
+{
+    if (!threadFileContext || !threadFileContext->stdinData || threadFileContext->stdinData->size() > maxSize)
+        return false;
+
+    data = threadFileContext->stdinData->data();
+    size = threadFileContext->stdinData->size();
+    return true;
+}
+
+
+#ifdef FILEIO_POSIX
+
+// Regular files mapped by InputFile. An output file which replaces one of them is created
+// as a new file, so the mapping keeps the old contents while the output is written.
+struct MappedFile {
+    const void* map;
+    dev_t dev;
+    ino_t ino;
+};
+
+static mutex mappedFilesMutex;
+static vector<MappedFile> mappedFiles;
+
+
+static void addMappedFile(const void* map, const struct stat& st)
+{
+    lock_guard<mutex> lock(mappedFilesMutex);
+    mappedFiles.push_back({map, st.st_dev, st.st_ino});
+}
+
+
+static void removeMappedFile(const void* map)
+{
+    lock_guard<mutex> lock(mappedFilesMutex);
+    mappedFiles.erase(remove_if(mappedFiles.begin(), mappedFiles.end(), [map](const MappedFile& file) {
+        return file.map == map;
+    }), mappedFiles.end());
+}
+
+
+static bool isMappedFile(const struct stat& st)
+{
+    lock_guard<mutex> lock(mappedFilesMutex);
+    return any_of(mappedFiles.begin(), mappedFiles.end(), [&st](const MappedFile& file) {
+        return file.dev == st.st_dev && file.ino == st.st_ino;
+    });
+}
+
+#endif // FILEIO_POSIX
+
+
+InputFile::~InputFile()
+{
+    close();
+}
+
+
+void InputFile::close()
+{
+#ifdef FILEIO_POSIX
+    if (m_map) {
+        removeMappedFile(m_map);
+        munmap(m_map, m_size);
+    }
+#endif
+    m_map = nullptr;
+    m_data = nullptr;
+    m_size = 0;
+    m_buf.clear();
+}
+
+
+#ifdef FILEIO_POSIX
+
+static bool readFd(int fd, size_t maxSize, vector<uint8_t>& buf)
+{
+    size_t size = 0;
+    buf.resize(4096);
+
+    for (;;) {
+        if (size == buf.size())
+            buf.resize(size * 2);
+
+        ssize_t res = read(fd, buf.data() + size, buf.size() - size);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        if (res == 0)
+            break;
+
+        size += res;
+        if (size > maxSize)
+            return false;
+    }
+
+    buf.resize(size);
+    return true;
+}
+
+
+bool InputFile::open(const string& fileName, size_t maxSize)
+{
+    close();
+
+    bool isStdin = fileName == "-";
+    if (isStdin && threadFileContext)
+        return openStdinData(maxSize, m_data, m_size);
+
+    int fd = isStdin ? STDIN_FILENO : ::open(resolvePath(fileName).c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    bool ok = openFd(fd, maxSize);
+
+    if (!isStdin)
+        ::close(fd);
+
+    return ok;
+}
+
+
+bool InputFile::openFd(int fd, size_t maxSize)
+{
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (size_t(st.st_size) > maxSize)
+            return false;
+
+        if (st.st_size > 0) {
+            void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                addMappedFile(map, st);
+                m_map = map;
+                m_data = static_cast<const uint8_t*>(map);
+                m_size = st.st_size;
+                return true;
+            }
+        }
+    }
+
+    // not a regular file (e. g. a pipe) or mmap failed
+    if (!readFd(fd, maxSize, m_buf)) {
+        m_buf.clear();
+        return false;
+    }
+
+    m_data = m_buf.data();
+    m_size = m_buf.size();
+    return true;
+}
+
+
+static bool writeIov(int fd, struct iovec* iov, int iovCnt)
+{
+    while (iovCnt) {
+        ssize_t res = writev(fd, iov, iovCnt);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        // partial write: skip what has been written
+        while (iovCnt && size_t(res) >= iov->iov_len) {
+            res -= iov->iov_len;
+            iov++;
+            iovCnt--;
+        }
+        if (iovCnt) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + res;
+            iov->iov_len -= res;
+        }
+    }
+
+    return true;
+}
+
+
+OutputFile::~OutputFile()
+{
+    close();
+}
+
+
+bool OutputFile::open(const string& fileName)
+{
+    close();
+
+    m_isStdout = fileName == "-";
+    if (openCapture())
+        return m_ok;
+
+    string path = resolvePath(fileName);
+
+    // don't change the contents of other hard links to the file (conversion cache entries)
+    // and of the input file mapped from it (the output file name may refer to the input one)
+    struct stat st;
+    if (!m_isStdout && stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && (st.st_nlink > 1 || isMappedFile(st)))
+        unlink(path.c_str());
+
+    m_fd = m_isStdout ? STDOUT_FILENO : ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    m_ok = m_fd >= 0;
+
+    return m_ok;
+}
+
+
+bool OutputFile::write(const OutputChunk* chunks, int nChunks)
+{
+    if (m_capture)
+        return writeCapture(chunks, nChunks);
+
+    const int maxChunks = 16;
+    struct iovec iov[maxChunks];
+
+    int i = 0;
+    while (m_ok && i < nChunks) {
+        int iovCnt = 0;
+        for (; i < nChunks && iovCnt < maxChunks; i++)
+            if (chunks[i].size) {
+                iov[iovCnt].iov_base = const_cast<void*>(chunks[i].data);
+                iov[iovCnt].iov_len = chunks[i].size;
+                iovCnt++;
+            }
+        m_ok = writeIov(m_fd, iov, iovCnt);
+    }
+
+    return m_ok;
+}
+
+
+bool OutputFile::close()
+{
+    if (m_capture)
+        return closeCapture();
+
+    if (m_fd < 0)
+        return false;
+
+    bool ok = m_ok;
+    if (!m_isStdout && ::close(m_fd))
+        ok = false;
+
+    m_fd = -1;
+    m_ok = false;
+
+    return ok;
+}
+
+#else // FILEIO_POSIX
+
+bool InputFile::open(const string& fileName, size_t maxSize)
+{
+    close();
+
+    if (fileName == "-" && threadFileContext)
+        return openStdinData(maxSize, m_data, m_size);
+
+    if (fileName == "-") {
+        _setmode(_fileno(stdin), _O_BINARY);
+
+        uint8_t buf[4096];
+        size_t res;
+        while ((res = fread(buf, 1, sizeof(buf), stdin)) > 0) {
+            m_buf.insert(m_buf.end(), buf, buf + res);
+            if (m_buf.size() > maxSize)
+                break;
+        }
+
+        if (ferror(stdin) || m_buf.size() > maxSize) {
+            m_buf.clear();
+            return false;
+        }
+
+        m_data = m_buf.data();
+        m_size = m_buf.size();
+        return true;
+    }
+
+    ifstream f(resolvePath(fileName), ifstream::binary);
+    if (f.fail())
+        return false;
+
+    f.seekg(0, ios_base::end);
+    size_t size = f.tellg();
+    if (size > maxSize)
+        return false;
+
+    f.seekg(0, ios_base::beg);
+    m_buf.resize(size);
+    f.read((char*)(m_buf.data()), size);
+    if (f.fail()) {
+        m_buf.clear();
+        return false;
+    }
+
+    m_data = m_buf.data();
+    m_size = size;
+    return true;
+}
+
+
+OutputFile::~OutputFile()
+{
+    close();
+}
+
+
+bool OutputFile::open(const string& fileName)
+{
+    close();
+
+    m_isStdout = fileName == "-";
+    if (openCapture())
+        return m_ok;
+
+    if (m_isStdout) {
+        _setmode(_fileno(stdout), _O_BINARY);
+        m_file = stdout;
+    } else
+        m_file = fopen(resolvePath(fileName).c_str(), "wb");
+    m_ok = m_file != nullptr;
+
+    return m_ok;
+}
+
+
+bool OutputFile::write(const OutputChunk* chunks, int nChunks)
+{
+    if (m_capture)
+        return writeCapture(chunks, nChunks);
+
+    for (int i = 0; m_ok && i < nChunks; i++)
+        m_ok = fwrite(chunks[i].data, 1, chunks[i].size, m_file) == chunks[i].size;
+
+    return m_ok;
+}
+
+
+bool OutputFile::close()
+{
+    if (m_capture)
+        return closeCapture();
+
+    if (!m_file)
+        return false;
+
+    bool ok = m_ok && fflush(m_file) == 0;
+    if (!m_isStdout && fclose(m_file))
+        ok = false;
+
+    m_file = nullptr;
+    m_ok = false;
+
+    return ok;
+}
+
+#endif // FILEIO_POSIX
+
+
+bool OutputFile::openCapture()
+{
+    if (!m_isStdout || !threadFileContext)
+        return false;
+
+    // without a buffer stdout is not available
+    m_capture = threadFileContext->stdoutData;
+    m_ok = m_capture != nullptr;
+    return true;
+}
+
+
+bool OutputFile::writeCapture(const OutputChunk* chunks, int nChunks)
+{
+    for (int i = 0; m_ok && i < nChunks; i++) {
+        const uint8_t* data = static_cast<const uint8_t*>(chunks[i].data);
+        m_capture->insert(m_capture->end(), data, data + chunks[i].size);
+    }
+
+    return m_ok;
+}
+
+
+bool OutputFile::closeCapture()
+{
+    bool ok = m_ok;
+    m_capture = nullptr;
+    m_ok = false;
+    return ok;
+}
+
+
+bool OutputFile::write(const void* data, size_t size)
+{
+    OutputChunk chunk = {data, size};
+    return write(&chunk, 1);
+}
+
+
+bool writeChunks(const string& fileName, const OutputChunk* chunks, int nChunks)
+{
+    OutputFile file;
+    if (!file.open(fileName))
+        return false;
+
+    file.write(chunks, nChunks);
+    return file.close();
+}
+
+
+bool writeTapeFile(const string& fileName, const TapeImage& image, const uint8_t* body, size_t bodySize)
+{
+    OutputChunk chunks[] = {{image.headerData(), size_t(image.headerSize)}, {body, bodySize}, {image.footerData(), size_t(image.footerSize)}};
+    return writeChunks(fileName, chunks, 3);
+}
+
+
+bool writeTapeContainer(const string& fileName, const TapeProgram* programs, size_t nPrograms, int align)
+{
+    static const uint8_t padding[16] = {};
+
+    vector<OutputChunk> chunks;
+    chunks.reserve(nPrograms * 4);
+
+    for (size_t i = 0; i < nPrograms; i++) {
+        const TapeProgram& program = programs[i];
+        chunks.push_back({program.image.headerData(), size_t(program.image.headerSize)});
+        chunks.push_back({program.body, program.bodySize});
+        chunks.push_back({program.image.footerData(), size_t(program.image.footerSize)});
+
+        size_t size = program.image.headerSize + program.bodySize + program.image.footerSize;
+        chunks.push_back({padding, (align - size % align) % align});
+    }
+
+    return writeChunks(fileName, chunks.data(), chunks.size());
+}
@@ -0,0 +1,128 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#ifndef FILEIO_H
+#define FILEIO_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+
+#include <string>
+#include <vector>
+
+
+// Returns the file name without extension (the path is kept)
+std::string cutExtension(const std::string& fileName);
+
+
+// File context of the calling thread. The server mode runs the requests of several clients
+// in one process, so relative file names are resolved against the client's working directory
+// and stdin/stdout ("-") are replaced with memory buffers.
+struct FileContext {
+    std::string workDir;                            // empty: the process working directory
+    const std::vector<uint8_t>* stdinData = nullptr;
+    std::vector<uint8_t>* stdoutData = nullptr;
+};
+
+void setFileContext(const FileContext* context);    // nullptr restores the default
+const FileContext* currentFileContext();
+std::string resolvePath(const std::string& fileName);
+
+
+// Read-only input file contents. Regular files are memory mapped where possible,
+// otherwise (or on Windows) the file is read into a buffer. "-" stands for stdin.
+class InputFile
+{
+public:
+    InputFile() = default;
+    ~InputFile();
+
+    InputFile(const InputFile&) = delete;
+    InputFile& operator=(const InputFile&) = delete;
+
+    // fails if the file can't be read or is larger than maxSize
+    bool open(const std::string& fileName, size_t maxSize);
+    void close();
+
+    const uint8_t* data() const {return m_data;}
+    size_t size() const {return m_size;}
+
+private:
+    const uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    void* m_map = nullptr;
+    std::vector<uint8_t> m_buf;
+
+    bool openFd(int fd, size_t maxSize);
+};
+
+
+struct OutputChunk {
+    const void* data;
+    size_t size;
+};
+
+
+// Output file for streaming writes, "-" stands for stdout
+class OutputFile
+{
+public:
+    OutputFile() = default;
+    ~OutputFile();
+
+    OutputFile(const OutputFile&) = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    bool open(const std::string& fileName);
+    bool write(const OutputChunk* chunks, int nChunks); // gathered write
+    bool write(const void* data, size_t size);
+    bool close(); // false if any write failed
+
+private:
+    bool m_isStdout = false;
+    bool m_ok = false;
+    std::vector<uint8_t>* m_capture = nullptr;     // stdout replaced by the file context
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__)
+    int m_fd = -1;
+#else
+    FILE* m_file = nullptr;
+#endif
+
+    bool openCapture();
+    bool writeCapture(const OutputChunk* chunks, int nChunks);
+    bool closeCapture();
+};
+
+
+// Writes the chunks to the file ("-" for stdout) with a single gathered write where possible
+bool writeChunks(const std::string& fileName, const OutputChunk* chunks, int nChunks);
+
+struct TapeImage;
+struct TapeProgram;
+
+// Writes header, body and footer of a tape file with a single gathered write, the body is not copied
+bool writeTapeFile(const std::string& fileName, const TapeImage& image, const uint8_t* body, size_t bodySize);
+
+// Writes several tape files one after another, each of them is padded with zeros to a multiple of align bytes
+bool writeTapeContainer(const std::string& fileName, const TapeProgram* programs, size_t nPrograms, int align);
+
+#endif // FILEIO_H
@@ -0,0 +1,71 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#include <cstring>
+
+#include "libbin2tape.h"
+
+
+size_t bin2tapeOutputSize(size_t bodySize, const Bin2TapeOptions& options)
+{
+    if (bodySize > bin2tapeMaxBodySize)
+        return 0;
+
+    return tapeFileSize(options.format, bodySize);
+}
+
+
+void bin2tapeImage(size_t bodySize, const BlockChecksums& bodyCs, const Bin2TapeOptions& options, TapeImage& image)
+{
+    uint8_t intFileName[8];
+    int intFileNameLen = intFileNameLength(options.format);
+    if (intFileNameLen)
+        makeIntName(options.intFileName ? options.intFileName : "", intFileNameLen, intFileName);
+
+    buildTapeImage(options.format, bodySize, bodyCs, options.loadAddr, options.runAddr, intFileName, image);
+}
+
+
+size_t bin2tapeConvert(const uint8_t* body, size_t bodySize, const BlockChecksums& bodyCs, const Bin2TapeOptions& options,
+                       uint8_t* output, size_t outputSize)
+{
+    size_t size = bin2tapeOutputSize(bodySize, options);
+    if (!size || size > outputSize)
+        return 0;
+
+    TapeImage image;
+    bin2tapeImage(bodySize, bodyCs, options, image);
+
+    memcpy(output, image.headerData(), image.headerSize);
+    memcpy(output + image.headerSize, body, bodySize);
+    memcpy(output + image.headerSize + bodySize, image.footerData(), image.footerSize);
+
+    return size;
+}
+
+
+size_t bin2tapeConvert(const uint8_t* body, size_t bodySize, const Bin2TapeOptions& options, uint8_t* output, size_t outputSize)
+{
+    if (bodySize > bin2tapeMaxBodySize)
+        return 0;
+
+    return bin2tapeConvert(body, bodySize, calcBlockChecksums(body, bodySize), options, output, outputSize);
+}
@@ -0,0 +1,61 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#ifndef LIBBIN2TAPE_H
+#define LIBBIN2TAPE_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include "tapeformat.h"
+
+
+// In-memory conversion API.
+//
+// All functions are reentrant: they don't allocate memory, don't access files and have no global
+// state, so they may be called from any number of threads. The output is written to a buffer
+// supplied by the caller, its exact size is known before the conversion.
+
+struct Bin2TapeOptions {
+    TapeFileFormat format;
+    uint16_t loadAddr;
+    uint16_t runAddr;           // used by the formats with a run address only (CAS, LVT)
+    const char* intFileName;    // the internal name is derived from it as in bin2tape -n, nullptr = no name
+};
+
+
+const size_t bin2tapeMaxBodySize = 0x10000;
+
+// Returns the exact size of the tape file or 0 if the body is too large
+size_t bin2tapeOutputSize(size_t bodySize, const Bin2TapeOptions& options);
+
+// Converts the body to a tape file in the output buffer. Returns the number of bytes written
+// or 0 if the body is too large or the buffer is too small.
+size_t bin2tapeConvert(const uint8_t* body, size_t bodySize, const Bin2TapeOptions& options, uint8_t* output, size_t outputSize);
+
+// The same with the checksums of the body calculated by the caller (to convert the body to several formats)
+size_t bin2tapeConvert(const uint8_t* body, size_t bodySize, const BlockChecksums& bodyCs, const Bin2TapeOptions& options,
+                       uint8_t* output, size_t outputSize);
+
+// Builds the header and the footer only, so that the body can be written out without copying
+void bin2tapeImage(size_t bodySize, const BlockChecksums& bodyCs, const Bin2TapeOptions& options, TapeImage& image);
+
+#endif // LIBBIN2TAPE_H
@@ -0,0 +1,16 @@
+TEMPLATE = lib
+CONFIG += staticlib c++11
+CONFIG -= qt
+
+TARGET = bin2tape
+
+SOURCES += \
+    libbin2tape.cpp \
+    checksum.cpp \
+    tapeformat.cpp
+
+HEADERS += \
+    libbin2tape.h \
+    bin2tape.h \
+    checksum.h \
+    tapeformat.h
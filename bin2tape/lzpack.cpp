@@ -0,0 +1,255 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#include <algorithm>
+
+#include "lzpack.h"
+
+using namespace std;
+
+
+// Longest match for every position, hash chains over the first lzMinMatch bytes
+static void findMatches(const uint8_t* data, size_t size, vector<uint8_t>& matchLen, vector<uint16_t>& matchDist)
+{
+    const int hashBits = 16;
+    const int maxChain = 512;
+
+    matchLen.assign(size, 0);
+    matchDist.assign(size, 0);
+    if (size < size_t(lzMinMatch))
+        return;
+
+    vector<int> head(1 << hashBits, -1);
+    vector<int> prev(size, -1);
+
+    for (size_t i = 0; i + lzMinMatch <= size; i++) {
+        uint32_t hash = (data[i] | (data[i + 1] << 8) | (data[i + 2] << 16) | (uint32_t(data[i + 3]) << 24)) * 2654435761u >> (32 - hashBits);
+
+        size_t maxLen = min(size - i, size_t(lzMaxMatch));
+        size_t bestLen = 0;
+        int chain = 0;
+        for (int cand = head[hash]; cand >= 0 && chain < maxChain; cand = prev[cand], chain++) {
+            if (i - cand > 0xFFFF)
+                break;
+            // data[cand..] is what the depacker copies, even if the match overlaps the current position
+            size_t len = 0;
+            while (len < maxLen && data[cand + len] == data[i + len])
+                len++;
+            if (len > bestLen) {
+                bestLen = len;
+                matchDist[i] = i - cand;
+                if (len == maxLen)
+                    break;
+            }
+        }
+        if (bestLen >= size_t(lzMinMatch))
+            matchLen[i] = bestLen;
+
+        prev[i] = head[hash];
+        head[hash] = i;
+    }
+}
+
+
+vector<uint8_t> lzPack(const uint8_t* data, size_t size)
+{
+    vector<uint8_t> matchLen;
+    vector<uint16_t> matchDist;
+    findMatches(data, size, matchLen, matchDist);
+
+    // optimal parsing from the end: cost[i] is the packed size of data[i..],
+    // step[i] > 0 is a literal run length, step[i] < 0 is a match length
+    vector<uint32_t> cost(size + 1);
+    vector<int> step(size + 1);
+    cost[size] = 1; // end token
+
+    for (size_t i = size; i-- > 0;) {
+        uint32_t best = UINT32_MAX;
+        size_t maxRun = min(size - i, size_t(lzMaxLiteralRun));
+        for (size_t run = 1; run <= maxRun; run++)
+            if (1 + run + cost[i + run] < best) {
+                best = 1 + run + cost[i + run];
+                step[i] = run;
+            }
+        for (int len = lzMinMatch; len <= matchLen[i]; len++)
+            if (3 + cost[i + len] < best) {
+                best = 3 + cost[i + len];
+                step[i] = -len;
+            }
+        cost[i] = best;
+    }
+
+    vector<uint8_t> packed;
+    packed.reserve(cost[0]);
+
+    for (size_t i = 0; i < size;) {
+        if (step[i] > 0) {
+            packed.push_back(step[i]);
+            packed.insert(packed.end(), data + i, data + i + step[i]);
+            i += step[i];
+        } else {
+            packed.push_back(0x80 | (-step[i] - lzMinMatch));
+            packed.push_back(matchDist[i] & 0xFF);
+            packed.push_back(matchDist[i] >> 8);
+            i += -step[i];
+        }
+    }
+    packed.push_back(0);
+
+    return packed;
+}
+
+
+bool lzUnpack(const uint8_t* packed, size_t packedSize, vector<uint8_t>& data)
+{
+    data.clear();
+
+    size_t pos = 0;
+    while (pos < packedSize) {
+        uint8_t token = packed[pos++];
+        if (!token)
+            return true;
+
+        if (token < 0x80) {
+            if (pos + token > packedSize)
+                return false;
+            data.insert(data.end(), packed + pos, packed + pos + token);
+            pos += token;
+        } else {
+            if (pos + 2 > packedSize)
+                return false;
+            size_t dist = packed[pos] | (packed[pos + 1] << 8);
+            pos += 2;
+            if (!dist || dist > data.size())
+                return false;
+            for (int i = 0; i < (token & 0x7F) + lzMinMatch; i++)
+                data.push_back(data[data.size() - dist]);
+        }
+    }
+
+    return false; // no end token
+}
+
+
+// The depacker, register usage: HL - packed data, DE - output, C - counter
+static const uint8_t depacker[] = {
+    0x21, 0x00, 0x00,   //          lxi  h, packed
+    0x11, 0x00, 0x00,   //          lxi  d, dest
+    0x7E,               // loop:    mov  a, m
+    0x23,               //          inx  h
+    0xB7,               //          ora  a
+    0xCA, 0x00, 0x00,   //          jz   run
+    0xFA, 0x1B, 0x00,   //          jm   match
+    0x4F,               //          mov  c, a
+    0x7E,               // literal: mov  a, m
+    0x12,               //          stax d
+    0x23,               //          inx  h
+    0x13,               //          inx  d
+    0x0D,               //          dcr  c
+    0xC2, 0x10, 0x00,   //          jnz  literal
+    0xC3, 0x06, 0x00,   //          jmp  loop
+    0xE6, 0x7F,         // match:   ani  7Fh
+    0xC6, lzMinMatch,   //          adi  lzMinMatch
+    0x4F,               //          mov  c, a
+    0x7B,               //          mov  a, e
+    0x96,               //          sub  m
+    0x47,               //          mov  b, a
+    0x23,               //          inx  h
+    0x7A,               //          mov  a, d
+    0x9E,               //          sbb  m
+    0x23,               //          inx  h
+    0x22, 0x3A, 0x00,   //          shld save   ; no stack is used, SP may point anywhere
+    0x67,               //          mov  h, a
+    0x68,               //          mov  l, b   ; HL = DE - distance
+    0x7E,               // copy:    mov  a, m
+    0x12,               //          stax d
+    0x23,               //          inx  h
+    0x13,               //          inx  d
+    0x0D,               //          dcr  c
+    0xC2, 0x2C, 0x00,   //          jnz  copy
+    0x2A, 0x3A, 0x00,   //          lhld save
+    0xC3, 0x06, 0x00,   //          jmp  loop
+    0x00, 0x00          // save:    dw   0
+};
+
+// offsets of the absolute addresses to be set or relocated
+static const int depackerPackedAddr = 1;
+static const int depackerDestAddr = 4;
+static const int depackerRunAddr = 10;
+static const int depackerRelocs[] = {13, 22, 25, 40, 50, 53, 56};
+
+
+bool makeSelfExtracting(const uint8_t* data, size_t size, uint16_t destAddr, uint16_t runAddr, SelfExtractingProgram& program)
+{
+    vector<uint8_t> packed = lzPack(data, size);
+
+    // Unpacking in place: every byte written must lie below the packed data not read yet.
+    // The minimal distance between the start of the packed data and destAddr is found
+    // by going through the tokens the same way as the depacker does.
+    long minOffset = 0;
+    size_t in = 0;
+    long out = 0;
+    while (packed[in]) {
+        uint8_t token = packed[in++];
+        if (token < 0x80) {
+            // a literal byte may overwrite itself after it's read
+            minOffset = max(minOffset, out - long(in));
+            in += token;
+            out += token;
+        } else {
+            in += 2;
+            out += (token & 0x7F) + lzMinMatch;
+            minOffset = max(minOffset, out - long(in));
+        }
+    }
+
+    long packedAddr = max(long(destAddr) + minOffset, 3L);
+    long depackerAddr = packedAddr + packed.size();
+    long loadAddr = packedAddr - 3;
+    if (loadAddr < 0 || depackerAddr + sizeof(depacker) > 0x10000)
+        return false;
+
+    program.loadAddr = loadAddr;
+    program.packedSize = packed.size();
+
+    auto put16 = [](uint8_t* ptr, unsigned value) {
+        ptr[0] = value & 0xFF;
+        ptr[1] = (value >> 8) & 0xFF;
+    };
+
+    vector<uint8_t>& prg = program.data;
+    prg.resize(3);
+    prg[0] = 0xC3; // jmp depacker
+    put16(&prg[1], depackerAddr);
+
+    prg.insert(prg.end(), packed.begin(), packed.end());
+
+    size_t depackerPos = prg.size();
+    prg.insert(prg.end(), depacker, depacker + sizeof(depacker));
+    uint8_t* dp = &prg[depackerPos];
+    put16(dp + depackerPackedAddr, packedAddr);
+    put16(dp + depackerDestAddr, destAddr);
+    put16(dp + depackerRunAddr, runAddr);
+    for (int reloc: depackerRelocs)
+        put16(dp + reloc, dp[reloc] + (dp[reloc + 1] << 8) + depackerAddr);
+
+    return true;
+}
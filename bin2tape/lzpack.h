@@ -0,0 +1,62 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#ifndef LZPACK_H
+#define LZPACK_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <vector>
+
+
+// LZ compression for self-extracting 8080 programs.
+//
+// The packed data is a sequence of tokens:
+//   00         end of data
+//   01-7F      literal run, the token is followed by that number of bytes
+//   80-FF      match: (token & 7F) + 4 bytes are copied from the already unpacked data,
+//              the token is followed by the 16-bit little endian distance back (the copy may overlap)
+// The format is chosen for a short and fast 8080 depacker rather than for the best ratio,
+// the packer uses optimal parsing to make up for it.
+
+const int lzMinMatch = 4;
+const int lzMaxMatch = 0x7F + lzMinMatch;
+const int lzMaxLiteralRun = 0x7F;
+
+std::vector<uint8_t> lzPack(const uint8_t* data, size_t size);
+bool lzUnpack(const uint8_t* packed, size_t packedSize, std::vector<uint8_t>& data);
+
+
+// Self-extracting program: a jump to the depacker, the packed data and the depacker itself,
+// which unpacks the data in place to destAddr and jumps to runAddr. The program is placed as
+// low as possible so that the data being unpacked never overwrites packed data not read yet
+// and the depacker lies above the unpacked data.
+struct SelfExtractingProgram {
+    std::vector<uint8_t> data;
+    uint16_t loadAddr;          // also the entry point
+    size_t packedSize;          // size of the packed data only
+};
+
+// false if the program doesn't fit into the 64K address space
+bool makeSelfExtracting(const uint8_t* data, size_t size, uint16_t destAddr, uint16_t runAddr, SelfExtractingProgram& program);
+
+#endif // LZPACK_H
@@ -0,0 +1,212 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#include <cstring>
+#include <cctype>
+
+#include "memmap.h"
+
+using namespace std;
+
+
+static string hex4(unsigned value)
+{
+    static const char digits[] = "0123456789ABCDEF";
+    string res(4, '0');
+    for (int i = 3; i >= 0; i--, value >>= 4)
+        res[i] = digits[value & 0xF];
+    return res;
+}
+
+
+bool MemoryMap::add(unsigned addr, const uint8_t* data, size_t size, string& errorMsg)
+{
+    if (addr + size > addrSpaceSize) {
+        errorMsg = "segment at " + hex4(addr) + " doesn't fit into 64K";
+        return false;
+    }
+
+    if (m_used.empty()) {
+        m_data.assign(addrSpaceSize, 0);
+        m_used.assign(addrSpaceSize / 64, 0);
+    }
+
+    for (unsigned a = addr; a < addr + size; a++)
+        if (isUsed(a)) {
+            errorMsg = "segments overlap at " + hex4(a);
+            return false;
+        }
+
+    memcpy(m_data.data() + addr, data, size);
+    for (unsigned a = addr; a < addr + size; a++)
+        m_used[a >> 6] |= 1ULL << (a & 63);
+
+    return true;
+}
+
+
+static int hexDigit(char ch)
+{
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    ch = toupper(ch);
+    if (ch >= 'A' && ch <= 'F')
+        return ch - 'A' + 10;
+    return -1;
+}
+
+
+bool MemoryMap::addIntelHex(const uint8_t* data, size_t size, string& errorMsg)
+{
+    const char* p = reinterpret_cast<const char*>(data);
+    const char* end = p + size;
+    unsigned baseAddr = 0;
+    int lineNum = 0;
+
+    while (p < end) {
+        const char* lineEnd = static_cast<const char*>(memchr(p, '\n', end - p));
+        if (!lineEnd)
+            lineEnd = end;
+        ++lineNum;
+
+        const char* q = p;
+        p = lineEnd + 1;
+
+        while (q < lineEnd && isspace(uint8_t(*q)))
+            ++q;
+        if (q == lineEnd)
+            continue;
+
+        // :LLAAAATTDD...CC
+        uint8_t record[5 + 255];
+        int len = 0;
+        bool ok = *q++ == ':';
+        while (ok && q + 1 < lineEnd && hexDigit(q[0]) >= 0 && len < int(sizeof(record))) {
+            int hi = hexDigit(q[0]);
+            int lo = hexDigit(q[1]);
+            ok = lo >= 0;
+            record[len++] = hi << 4 | lo;
+            q += 2;
+        }
+        while (q < lineEnd && isspace(uint8_t(*q)))
+            ++q;
+
+        uint8_t cs = 0;
+        for (int i = 0; i < len; i++)
+            cs += record[i];
+
+        int type = len >= 4 ? record[3] : -1;
+        bool addrRecord = type == 2 || type == 4;
+        bool startRecord = type == 3 || type == 5;
+
+        if (!ok || q != lineEnd || len < 5 || len != record[0] + 5 || cs || (addrRecord && record[0] != 2) || (startRecord && record[0] != 4)) {
+            errorMsg = "invalid Intel HEX record at line " + to_string(lineNum);
+            return false;
+        }
+
+        int dataLen = record[0];
+        unsigned addr = record[1] << 8 | record[2];
+        const uint8_t* recordData = record + 4;
+
+        switch (type) {
+        case 0: // data
+            if (!add(baseAddr + addr, recordData, dataLen, errorMsg))
+                return false;
+            break;
+        case 1: // end of file
+            return true;
+        case 2: // extended segment address
+        case 4: // extended linear address
+            baseAddr = (recordData[0] << 8 | recordData[1]) << (type == 2 ? 4 : 16);
+            break;
+        case 3: // start segment address (CS:IP)
+        case 5: // start linear address
+            m_hasStartAddr = true;
+            m_startAddr = recordData[2] << 8 | recordData[3];
+            break;
+        default:
+            errorMsg = "unknown Intel HEX record type at line " + to_string(lineNum);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// Returns the first address from addr on which is used (or free), addrSpaceSize if there is none
+unsigned MemoryMap::findUsed(unsigned addr, bool used) const
+{
+    while (addr < addrSpaceSize) {
+        uint64_t word = m_used[addr >> 6];
+        if (!used)
+            word = ~word;
+        word &= ~0ULL << (addr & 63);
+        if (word)
+            return (addr & ~63U) + __builtin_ctzll(word);
+        addr = (addr & ~63U) + 64;
+    }
+    return addrSpaceSize;
+}
+
+
+MemoryBlock MemoryMap::contiguousBlock() const
+{
+    MemoryBlock block = {0, 0, nullptr};
+    if (empty())
+        return block;
+
+    unsigned first = findUsed(0, true);
+    unsigned last = first;
+    for (unsigned a = first; a < addrSpaceSize; ) {
+        unsigned rangeEnd = findUsed(a, false);
+        last = rangeEnd - 1;
+        a = findUsed(rangeEnd, true);
+    }
+
+    block.addr = first;
+    block.size = last - first + 1;
+    block.data = m_data.data() + first;
+    return block;
+}
+
+
+vector<MemoryBlock> MemoryMap::blocks(size_t maxGap) const
+{
+    vector<MemoryBlock> res;
+    if (empty())
+        return res;
+
+    for (unsigned a = findUsed(0, true); a < addrSpaceSize; ) {
+        unsigned rangeEnd = findUsed(a, false);
+
+        if (!res.empty() && a - (res.back().addr + res.back().size) <= maxGap)
+            res.back().size = rangeEnd - res.back().addr;
+        else {
+            MemoryBlock block = {uint16_t(a), rangeEnd - a, m_data.data() + a};
+            res.push_back(block);
+        }
+
+        a = findUsed(rangeEnd, true);
+    }
+
+    return res;
+}
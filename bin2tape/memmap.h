@@ -0,0 +1,71 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#ifndef MEMMAP_H
+#define MEMMAP_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+#include <vector>
+
+
+struct MemoryBlock {
+    uint16_t addr;
+    size_t size;
+    const uint8_t* data;
+};
+
+
+// Sparse map of the 64K address space built from several input segments or an Intel HEX file
+class MemoryMap
+{
+public:
+    static const unsigned addrSpaceSize = 0x10000;
+
+    // fails if the segment doesn't fit into the address space or overlaps with the ones added before
+    bool add(unsigned addr, const uint8_t* data, size_t size, std::string& errorMsg);
+
+    // adds all data records of an Intel HEX file, the start address record (if any) sets the start address
+    bool addIntelHex(const uint8_t* data, size_t size, std::string& errorMsg);
+
+    bool empty() const {return m_used.empty();}
+    bool hasStartAddr() const {return m_hasStartAddr;}
+    uint16_t startAddr() const {return m_startAddr;}
+
+    // one block from the lowest to the highest used address, the gaps are filled with zeros
+    MemoryBlock contiguousBlock() const;
+
+    // the used ranges, gaps not longer than maxGap bytes are included into the blocks
+    std::vector<MemoryBlock> blocks(size_t maxGap) const;
+
+private:
+    std::vector<uint8_t> m_data;    // allocated on the first add()
+    std::vector<uint64_t> m_used;   // bitmap of used addresses
+    bool m_hasStartAddr = false;
+    uint16_t m_startAddr = 0;
+
+    bool isUsed(unsigned addr) const {return m_used[addr >> 6] & (1ULL << (addr & 63));}
+    unsigned findUsed(unsigned addr, bool used) const;
+};
+
+#endif // MEMMAP_H
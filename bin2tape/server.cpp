@@ -0,0 +1,344 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <iostream>
+
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__)
+#define SERVER_POSIX
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#endif
+
+#include "server.h"
+#include "fileio.h"
+
+using namespace std;
+
+
+#ifdef SERVER_POSIX
+
+// Wire format, all numbers are 32-bit in the host byte order (the socket is local),
+// a blob is its length followed by the bytes:
+//   request:  "B2TQ", argc, argc blobs, working directory blob, stdin flag, stdin blob
+//   response: "B2TR", exit code, stdout messages blob, stderr messages blob, stdout data blob
+
+static const uint32_t requestMagic = 0x51543242;   // "B2TQ"
+static const uint32_t responseMagic = 0x52543242;  // "B2TR"
+
+static const uint32_t maxArgs = 4096;
+static const uint32_t maxBlobSize = 64 << 20;
+
+// a client which stalls for longer while sending the request or reading the response is dropped,
+// so that idle connections can't hold all the worker threads
+static const int clientTimeoutSec = 10;
+
+
+static bool sendAll(int fd, const void* data, size_t size)
+{
+    const char* ptr = static_cast<const char*>(data);
+    while (size) {
+        ssize_t res = send(fd, ptr, size, 0);
+        if (res < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        ptr += res;
+        size -= res;
+    }
+    return true;
+}
+
+
+static bool recvAll(int fd, void* data, size_t size)
+{
+    char* ptr = static_cast<char*>(data);
+    while (size) {
+        ssize_t res = recv(fd, ptr, size, 0);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            return false;
+        ptr += res;
+        size -= res;
+    }
+    return true;
+}
+
+
+static void putU32(vector<uint8_t>& buf, uint32_t value)
+{
+    const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&value);
+    buf.insert(buf.end(), ptr, ptr + sizeof(value));
+}
+
+
+static void putBlob(vector<uint8_t>& buf, const void* data, size_t size)
+{
+    putU32(buf, size);
+    const uint8_t* ptr = static_cast<const uint8_t*>(data);
+    buf.insert(buf.end(), ptr, ptr + size);
+}
+
+
+static void putBlob(vector<uint8_t>& buf, const string& str)
+{
+    putBlob(buf, str.data(), str.size());
+}
+
+
+static bool recvU32(int fd, uint32_t& value)
+{
+    return recvAll(fd, &value, sizeof(value));
+}
+
+
+template <typename T>
+static bool recvBlob(int fd, T& blob)
+{
+    uint32_t size;
+    if (!recvU32(fd, size) || size > maxBlobSize)
+        return false;
+    blob.resize(size);
+    return !size || recvAll(fd, &blob[0], size);
+}
+
+
+static bool makeSocketAddr(const string& socketName, sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketName.empty() || socketName.size() >= sizeof(addr.sun_path))
+        return false;
+    memcpy(addr.sun_path, socketName.c_str(), socketName.size());
+    return true;
+}
+
+
+static int connectToServer(const string& socketName)
+{
+    sockaddr_un addr;
+    if (!makeSocketAddr(socketName, addr))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+static void handleRequest(int fd, const ServerRequestHandler& handler)
+{
+    uint32_t magic, argc, hasStdin;
+    if (!recvU32(fd, magic) || magic != requestMagic || !recvU32(fd, argc) || argc > maxArgs)
+        return;
+
+    vector<string> args(argc);
+    for (auto& arg: args)
+        if (!recvBlob(fd, arg))
+            return;
+
+    vector<uint8_t> stdinData, stdoutData;
+    FileContext context;
+    if (!recvBlob(fd, context.workDir) || !recvU32(fd, hasStdin) || !recvBlob(fd, stdinData))
+        return;
+    context.stdinData = hasStdin ? &stdinData : nullptr;
+    context.stdoutData = &stdoutData;
+
+    ostringstream out, err;
+    int exitCode;
+
+    setFileContext(&context);
+    try {
+        exitCode = handler(args, out, err);
+    } catch (const exception& e) {
+        err << "Server error: " << e.what() << endl;
+        exitCode = 1;
+    }
+    setFileContext(nullptr);
+
+    vector<uint8_t> response;
+    putU32(response, responseMagic);
+    putU32(response, exitCode);
+    putBlob(response, out.str());
+    putBlob(response, err.str());
+    putBlob(response, stdoutData.data(), stdoutData.size());
+
+    sendAll(fd, response.data(), response.size());
+}
+
+
+static string serverSocketName;
+
+
+static void onTerminate(int sig)
+{
+    unlink(serverSocketName.c_str());
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+
+int runServer(const string& socketName, unsigned nThreads, const ServerRequestHandler& handler, ostream& msg)
+{
+    sockaddr_un addr;
+    if (!makeSocketAddr(socketName, addr)) {
+        cout << "Invalid socket name " << socketName << endl;
+        return 1;
+    }
+
+    // a socket left by a server that is not running anymore is replaced
+    int clientFd = connectToServer(socketName);
+    if (clientFd >= 0) {
+        close(clientFd);
+        cout << "Server is already running at " << socketName << endl;
+        return 1;
+    }
+    struct stat st;
+    if (stat(socketName.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(socketName.c_str());
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) || listen(listenFd, SOMAXCONN)) {
+        cout << "Can't create socket " << socketName << ": " << strerror(errno) << endl;
+        return 1;
+    }
+
+    serverSocketName = socketName;
+    signal(SIGINT, onTerminate);
+    signal(SIGTERM, onTerminate);
+    signal(SIGPIPE, SIG_IGN); // a client that has gone away must not kill the server
+
+    if (!nThreads)
+        nThreads = thread::hardware_concurrency();
+    if (!nThreads)
+        nThreads = 1;
+
+    msg << "Listening at " << socketName << ", " << nThreads << " worker thread(s)" << endl;
+
+    // every worker accepts connections itself, so an idle worker takes the next request
+    auto worker = [listenFd, &handler]() {
+        for (;;) {
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno != EINTR)
+                    this_thread::sleep_for(chrono::milliseconds(10)); // e. g. out of file descriptors
+                continue;
+            }
+            timeval timeout = {clientTimeoutSec, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            handleRequest(fd, handler);
+            close(fd);
+        }
+    };
+
+    vector<thread> workers;
+    for (unsigned i = 0; i < nThreads; i++)
+        workers.emplace_back(worker);
+    for (auto& w: workers)
+        w.join();
+
+    return 0;
+}
+
+
+int runClient(const string& socketName, const vector<string>& args, bool sendStdin)
+{
+    int fd = connectToServer(socketName);
+    if (fd < 0)
+        return -1;
+
+    vector<uint8_t> request;
+    putU32(request, requestMagic);
+    putU32(request, args.size());
+    for (const auto& arg: args)
+        putBlob(request, arg);
+
+    vector<char> cwd(4096);
+    while (!getcwd(cwd.data(), cwd.size()) && errno == ERANGE)
+        cwd.resize(cwd.size() * 2);
+    putBlob(request, string(cwd.data()));
+
+    // stdin is read here, the server gets its contents
+    InputFile stdinFile;
+    bool stdinOk = sendStdin && stdinFile.open("-", maxBlobSize);
+    putU32(request, stdinOk);
+    putBlob(request, stdinFile.data(), stdinFile.size());
+    stdinFile.close();
+
+    uint32_t magic, exitCode;
+    string out, err;
+    vector<uint8_t> data;
+    bool ok = sendAll(fd, request.data(), request.size()) &&
+            recvU32(fd, magic) && magic == responseMagic && recvU32(fd, exitCode) &&
+            recvBlob(fd, out) && recvBlob(fd, err) && recvBlob(fd, data);
+    close(fd);
+
+    if (!ok) {
+        cerr << "Connection to the server at " << socketName << " lost" << endl;
+        return 1;
+    }
+
+    cout << out << flush;
+    if (!data.empty()) {
+        OutputFile stdoutFile;
+        stdoutFile.open("-");
+        stdoutFile.write(data.data(), data.size());
+        if (!stdoutFile.close())
+            exitCode = 1;
+    }
+    cerr << err << flush;
+
+    return exitCode;
+}
+
+#else // SERVER_POSIX
+
+int runServer(const string& socketName, unsigned, const ServerRequestHandler&, ostream&)
+{
+    cout << "Server mode is not supported on this platform (" << socketName << ")" << endl;
+    return 1;
+}
+
+
+int runClient(const string&, const vector<string>&, bool)
+{
+    return -1;
+}
+
+#endif // SERVER_POSIX
@@ -0,0 +1,48 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <functional>
+
+
+// Conversion server on a Unix domain socket (not available on Windows).
+//
+// A request is a regular bin2tape command line together with the client's working directory
+// and its stdin contents, the response contains the exit code, the messages and the data
+// written to stdout. Output files are written by the server itself.
+
+// runs the command line, out and err stand for the client's stdout and stderr, returns the exit code
+typedef std::function<int(const std::vector<std::string>& args, std::ostream& out, std::ostream& err)> ServerRequestHandler;
+
+// Handles requests with a pool of nThreads worker threads (0 = number of CPU cores),
+// returns only if the socket can't be created
+int runServer(const std::string& socketName, unsigned nThreads, const ServerRequestHandler& handler, std::ostream& msg);
+
+// Runs the command line on the server and outputs the result, stdin is sent only if sendStdin is set.
+// Returns the exit code or -1 if the server is not available.
+int runClient(const std::string& socketName, const std::vector<std::string>& args, bool sendStdin);
+
+#endif // SERVER_H
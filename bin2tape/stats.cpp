@@ -0,0 +1,117 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#include <iomanip>
+#include <sstream>
+
+#include "stats.h"
+#include "bin2tape.h"
+
+using namespace std;
+
+
+static string jsonString(const string& str)
+{
+    ostringstream res;
+    res << '"';
+    for (char ch: str) {
+        if (ch == '"' || ch == '\\')
+            res << '\\' << ch;
+        else if (uint8_t(ch) < 0x20)
+            res << "\\u" << hex << setfill('0') << setw(4) << int(ch) << dec;
+        else
+            res << ch;
+    }
+    res << '"';
+    return res.str();
+}
+
+
+static string hex16(unsigned value)
+{
+    ostringstream res;
+    res << '"' << hex << uppercase << setfill('0') << setw(4) << (value & 0xFFFF) << '"';
+    return res.str();
+}
+
+
+void writeStatsJson(ostream& out, const vector<const InputStats*>& inputs, double wallTime, unsigned nThreads)
+{
+    size_t totalIn = 0, totalOut = 0;
+    unsigned nErrors = 0, nOutputs = 0, nCacheHits = 0;
+    double readTime = 0, packTime = 0, checksumTime = 0, buildTime = 0, writeTime = 0;
+
+    out << fixed << setprecision(1);
+    out << "{\n  \"version\": \"" VERSION "\",\n  \"files\": [";
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        const InputStats& input = *inputs[i];
+
+        out << (i ? "," : "") << "\n    {\"input\": " << jsonString(input.fileName) << ", \"ok\": " << (input.ok ? "true" : "false");
+        if (!input.ok)
+            out << ", \"error\": " << jsonString(input.errorMsg);
+        out << ", \"bytes_in\": " << input.bytesIn << ", \"read_us\": " << input.readTime << ", \"pack_us\": " << input.packTime <<
+               ", \"blocks\": [";
+
+        totalIn += input.bytesIn;
+        nErrors += !input.ok;
+        readTime += input.readTime;
+        packTime += input.packTime;
+
+        for (size_t j = 0; j < input.blocks.size(); j++) {
+            const BlockStats& block = input.blocks[j];
+
+            out << (j ? "," : "") << "\n      {\"addr\": " << hex16(block.addr) << ", \"size\": " << block.size <<
+                   ", \"checksum_us\": " << block.checksumTime << ", \"checksums\": {\"byte_sum\": " << block.cs.byteSum <<
+                   ", \"rk\": " << hex16(block.cs.rkCs) << ", \"rkm\": " << hex16(block.cs.rkmCs) << ", \"rku\": " << hex16(block.cs.rkuCs) <<
+                   "}, \"outputs\": [";
+
+            checksumTime += block.checksumTime;
+
+            for (size_t k = 0; k < block.outputs.size(); k++) {
+                const OutputStats& output = block.outputs[k];
+
+                out << (k ? "," : "") << "\n        {\"file\": " << jsonString(output.fileName) << ", \"format\": " << jsonString(output.format) <<
+                       ", \"bytes_out\": " << output.bytesOut << ", \"build_us\": " << output.buildTime << ", \"write_us\": " << output.writeTime <<
+                       ", \"cache_hit\": " << (output.cacheHit ? "true" : "false") << "}";
+
+                totalOut += output.bytesOut;
+                buildTime += output.buildTime;
+                writeTime += output.writeTime;
+                ++nOutputs;
+                nCacheHits += output.cacheHit;
+            }
+            out << (block.outputs.empty() ? "" : "\n      ") << "]}";
+        }
+        out << (input.blocks.empty() ? "" : "\n    ") << "]}";
+    }
+
+    double wallSecs = wallTime / 1e6;
+
+    out << (inputs.empty() ? "" : "\n  ") << "],\n  \"summary\": {\n" <<
+           "    \"files\": " << inputs.size() << ", \"errors\": " << nErrors << ", \"outputs\": " << nOutputs << ", \"cache_hits\": " << nCacheHits << ",\n" <<
+           "    \"bytes_in\": " << totalIn << ", \"bytes_out\": " << totalOut << ", \"threads\": " << nThreads << ",\n" <<
+           "    \"wall_us\": " << wallTime << ", \"read_us\": " << readTime << ", \"pack_us\": " << packTime << ", \"checksum_us\": " << checksumTime <<
+           ", \"build_us\": " << buildTime << ", \"write_us\": " << writeTime << ",\n" <<
+           "    \"files_per_s\": " << (wallSecs > 0 ? inputs.size() / wallSecs : 0) <<
+           ", \"mb_in_per_s\": " << setprecision(3) << (wallSecs > 0 ? totalIn / wallSecs / 1e6 : 0) <<
+           ", \"mb_out_per_s\": " << (wallSecs > 0 ? totalOut / wallSecs / 1e6 : 0) << "\n  }\n}" << endl;
+}
@@ -0,0 +1,91 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ostream>
+
+#include "checksum.h"
+
+
+// Conversion statistics for --stats=json: phase timings (in microseconds), sizes and checksums
+// of every input file, block and output file.
+
+struct OutputStats {
+    std::string fileName;
+    std::string format;
+    size_t bytesOut = 0;
+    double buildTime = 0;       // header, footer (and WAV tables)
+    double writeTime = 0;
+    bool cacheHit = false;
+};
+
+
+struct BlockStats {
+    uint16_t addr = 0;
+    size_t size = 0;
+    BlockChecksums cs = {};
+    double checksumTime = 0;
+    std::vector<OutputStats> outputs;
+};
+
+
+struct InputStats {
+    std::string fileName;
+    bool ok = false;
+    std::string errorMsg;
+    size_t bytesIn = 0;
+    double readTime = 0;
+    double packTime = 0;
+    std::vector<BlockStats> blocks;
+};
+
+
+// Measures the time between the calls of lap()
+class StatsTimer
+{
+public:
+    StatsTimer() : m_start(std::chrono::steady_clock::now()) {}
+
+    double lap()
+    {
+        auto now = std::chrono::steady_clock::now();
+        double us = std::chrono::duration<double, std::micro>(now - m_start).count();
+        m_start = now;
+        return us;
+    }
+
+private:
+    std::chrono::steady_clock::time_point m_start;
+};
+
+
+// Writes the statistics of all inputs and the totals, wallTime in microseconds
+void writeStatsJson(std::ostream& out, const std::vector<const InputStats*>& inputs, double wallTime, unsigned nThreads);
+
+#endif // STATS_H
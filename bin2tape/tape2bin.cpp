@@ -0,0 +1,421 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+// Tape image decoder: extracts the binary body from any format written by bin2tape
+// or transcodes it directly to other tape formats.
+
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+
+#include <cstring>
+
+#include "bin2tape.h"
+#include "checksum.h"
+#include "fileio.h"
+#include "tapeformat.h"
+#include "libbin2tape.h"
+
+
+using namespace std;
+
+void usage(string& moduleName, ostream& out = cout)
+{
+            out << "Usage: " << moduleName << " [options] input_file [output_file]" << endl << endl <<
+            "options are:" << endl << endl <<
+            "  -f format" << endl <<
+            "    input file format (see bin2tape), default is based on input file extension," << endl <<
+            "    the format is detected by the contents if the extension is unknown" << endl << endl <<
+            "  -t bin|format[,format...]" << endl <<
+            "    output file format(s): bin (default) or tape formats to transcode to" << endl << endl <<
+            "  -a addr" << endl <<
+            "    load address for the output tape files (hex), default is taken from the input file" << endl << endl <<
+            "  -r run_addr" << endl <<
+            "    run address for cas and lvt formats (hex), default is taken from the input file" << endl << endl <<
+            "  -n filename" << endl <<
+            "    internal file name for the output tape files, default is taken from the input file" << endl << endl <<
+            "  -p num" << endl <<
+            "    extract only the program num (starting from 1) of a cas or rko container," << endl <<
+            "    by default all programs are extracted to files numbered by the program" << endl << endl <<
+            "  -l" << endl <<
+            "    list the programs only, no files are written" << endl << endl <<
+            "  -i" << endl <<
+            "    ignore checksum errors" << endl << endl <<
+            "  -q" << endl <<
+            "    quiet mode, only errors are reported" << endl << endl <<
+            "input_file - tape file name, \"-\" to read from stdin" << endl <<
+            "output_file - output file name, \"-\" to write to stdout (default for stdin input)," << endl <<
+            "    default is based on input file name; with several formats it is used as a base name" << endl << endl <<
+            "When the output is written to stdout all messages go to stderr." << endl;
+}
+
+
+struct OutputFormat {
+    bool bin;
+    TapeFileFormat format;
+    string ext;
+    string outputFileName;
+};
+
+
+struct DecodeParams {
+    vector<OutputFormat> formats = {{true, TFF_RK, "bin", ""}};
+    TapeFileFormat inputFormat = TFF_RK;
+    uint16_t loadAddr = 0;
+    uint16_t runAddr = 0;
+    unsigned program = 0;
+    string intFileName;
+    string inputFileName;
+    string outputFileName;
+
+    bool inputFormatSpecified = false;
+    bool loadAddrSpecified = false;
+    bool runAddrSpecified = false;
+    bool intFileSpecified = false;
+    bool programSpecified = false;
+    bool inputFileSpecified = false;
+    bool outputFileSpecified = false;
+    bool ignoreCs = false;
+    bool listOnly = false;
+    bool quiet = false;
+};
+
+
+bool parseArgs(const vector<string>& args, DecodeParams& params, string& errorMsg)
+{
+    errorMsg.clear();
+
+    for (unsigned i = 0; i < args.size(); i++) {
+        const string& option = args[i];
+
+        if (option == "-f" || option == "-t" || option == "-a" || option == "-r" || option == "-n" || option == "-p") {
+            if (++i >= args.size())
+                return false;
+
+            const string& value = args[i];
+
+            if (option == "-f") {
+                if (!parseFormat(value, params.inputFormat)) {
+                    errorMsg = "Invalid input format specification!";
+                    return false;
+                }
+                params.inputFormatSpecified = true;
+            } else if (option == "-t") {
+                params.formats.clear();
+                size_t pos = 0;
+                do {
+                    size_t end = value.find(',', pos);
+                    OutputFormat fmt;
+                    fmt.ext = value.substr(pos, end == string::npos ? string::npos : end - pos);
+                    fmt.bin = fmt.ext == "bin";
+                    if (!fmt.bin && !parseFormat(fmt.ext, fmt.format)) {
+                        errorMsg = "Invalid format specification!";
+                        return false;
+                    }
+                    params.formats.push_back(fmt);
+                    pos = end == string::npos ? end : end + 1;
+                } while (pos != string::npos);
+            } else if (option == "-a" || option == "-r") {
+                char* numEnd;
+                uint16_t addr = strtoul(value.c_str(), &numEnd, 16);
+                if (*numEnd) {
+                    errorMsg = option == "-a" ? "Invalid load address!" : "Invalid run address!";
+                    return false;
+                }
+                if (option == "-a") {
+                    params.loadAddr = addr;
+                    params.loadAddrSpecified = true;
+                } else {
+                    params.runAddr = addr;
+                    params.runAddrSpecified = true;
+                }
+            } else if (option == "-p") {
+                char* numEnd;
+                params.program = strtoul(value.c_str(), &numEnd, 10);
+                if (*numEnd || !params.program) {
+                    errorMsg = "Invalid program number!";
+                    return false;
+                }
+                params.programSpecified = true;
+            } else { // -n
+                params.intFileName = value;
+                params.intFileSpecified = true;
+            }
+        } else if (option == "-i") {
+            params.ignoreCs = true;
+        } else if (option == "-l") {
+            params.listOnly = true;
+        } else if (option == "-q") {
+            params.quiet = true;
+        } else {
+            if (option[0] == '-' && option != "-") {
+                errorMsg = "Invalid option:" + option;
+                return false;
+            }
+
+            if (!params.inputFileSpecified) {
+                params.inputFileName = option;
+                params.inputFileSpecified = true;
+            } else if (!params.outputFileSpecified) {
+                params.outputFileName = option;
+                params.outputFileSpecified = true;
+            } else
+                return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool completeParams(DecodeParams& params, string& errorMsg)
+{
+    bool multiFormat = params.formats.size() > 1;
+
+    if (params.inputFileName == "-") {
+        if (!params.outputFileSpecified && !multiFormat) {
+            params.outputFileName = "-";
+            params.outputFileSpecified = true;
+        }
+    } else {
+        string inputFileNameWoPath = params.inputFileName.substr(params.inputFileName.find_last_of("/\\:") + 1);
+
+        // the input format is taken from the extension if possible
+        if (!params.inputFormatSpecified) {
+            size_t dotPos = inputFileNameWoPath.find_last_of('.');
+            string ext = dotPos == string::npos ? "" : inputFileNameWoPath.substr(dotPos + 1);
+            for (auto& ch: ext)
+                ch = tolower(ch);
+            params.inputFormatSpecified = parseFormat(ext, params.inputFormat);
+        }
+
+        if (!params.outputFileSpecified)
+            params.outputFileName = cutExtension(inputFileNameWoPath);
+    }
+
+    if (multiFormat && (params.outputFileName == "-" || params.outputFileName.empty())) {
+        errorMsg = "Several formats can't be written to stdout!";
+        return false;
+    }
+
+    for (auto& fmt: params.formats) {
+        if (params.outputFileSpecified && !multiFormat)
+            fmt.outputFileName = params.outputFileName;
+        else
+            fmt.outputFileName = cutExtension(params.outputFileName) + "." + fmt.ext;
+
+        if (fmt.outputFileName == params.inputFileName && fmt.outputFileName != "-") {
+            errorMsg = "Output file name is the same as the input one: " + fmt.outputFileName;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+// internal file name as a string without trailing spaces
+string intFileNameStr(const TapeFileInfo& info)
+{
+    string name(reinterpret_cast<const char*>(info.intFileName), info.intFileNameLen);
+    size_t end = name.find_last_not_of(" \0", string::npos, 2);
+    return name.substr(0, end == string::npos ? 0 : end + 1);
+}
+
+
+// output file name of one of several programs of a container: name_<number>.ext
+string programFileName(const string& fileName, size_t number)
+{
+    string baseName = cutExtension(fileName);
+    return baseName + "_" + to_string(number) + fileName.substr(baseName.size());
+}
+
+
+void printInfo(const TapeFileInfo& info, ostream& msg)
+{
+    msg << "\tLoad address:\t" << setfill('0') << setw(4) << uppercase << hex << info.loadAddr << endl;
+    msg << "\tEnd address:\t" << setfill('0') << setw(4) << uppercase << hex << ((info.loadAddr + info.bodySize - 1) & 0xFFFF) << endl;
+    if (info.hasRunAddr)
+        msg << "\tRun address:\t" << setfill('0') << setw(4) << uppercase << hex << info.runAddr << endl;
+    if (info.intFileNameLen)
+        msg << "\tInt. file name:\t" << intFileNameStr(info) << endl;
+    if (info.hasCs)
+        msg << "\tChecksum:\t" << setfill('0') << setw(4) << uppercase << hex << info.storedCs << endl;
+    msg << dec;
+}
+
+
+int main(int argc, const char** argv)
+{
+    static_assert(sizeof(RkFooter) == 5, "Packed structs required!");
+
+    const char* banner = "tape2bin v. " VERSION " (c) Viktor Pykhonin, 2021-2023";
+
+    string moduleName = argv[0];
+    moduleName = moduleName.substr(moduleName.find_last_of("/\\:") + 1);
+
+    if (argc < 2) {
+        cout << banner << endl << endl;
+        usage(moduleName);
+        return 1;
+    }
+
+    vector<string> args(argv + 1, argv + argc);
+
+    DecodeParams params;
+    string errorMsg;
+
+    bool argsOk = parseArgs(args, params, errorMsg);
+
+    bool toStdout = params.outputFileName == "-" || (params.inputFileName == "-" && !params.outputFileSpecified && params.formats.size() == 1);
+    ostream nullStream(nullptr);
+    ostream& err = toStdout ? cerr : cout;
+    ostream& msg = params.quiet ? nullStream : err;
+
+    msg << banner << endl << endl;
+
+    if (!argsOk) {
+        if (!errorMsg.empty())
+            err << errorMsg << endl << endl;
+        usage(moduleName, err);
+        return 1;
+    }
+
+    if (!params.inputFileSpecified) {
+        err << "No input file name specified!" << endl << endl;
+        usage(moduleName, err);
+        return 1;
+    }
+
+    if (!completeParams(params, errorMsg)) {
+        err << errorMsg << endl;
+        return 1;
+    }
+
+    // a container may hold many programs, the format of a file with an unknown extension is detected after reading
+    InputFile input;
+    bool container = !params.inputFormatSpecified || isContainerFormat(params.inputFormat);
+    if (!input.open(params.inputFileName, container ? maxTapeContainerSize : maxTapeFileSize)) {
+        err << "Input file error" << endl;
+        return 1;
+    }
+
+    if (!params.inputFormatSpecified && !detectTapeFormat(input.data(), input.size(), params.inputFormat)) {
+        err << "Unknown input file format!" << endl;
+        return 1;
+    }
+
+    vector<TapeFileInfo> programs;
+    size_t errorProgram;
+    TapeDecodeResult res = decodeTapeContainer(input.data(), input.size(), params.inputFormat, programs, errorProgram);
+
+    string errorProgramStr = programs.size() > 1 ? " (program " + to_string(errorProgram + 1) + ")" : "";
+    if (res == TDR_BAD_FORMAT) {
+        err << "Input file is not a valid " << tapeFormatDesc(params.inputFormat).name << " file" << errorProgramStr << "!" << endl;
+        return 1;
+    } else if (res == TDR_TRUNCATED) {
+        err << "Input file is truncated" << errorProgramStr << "!" << endl;
+        return 1;
+    }
+
+    if (params.programSpecified && params.program > programs.size()) {
+        err << "Input file has " << programs.size() << " program(s) only!" << endl;
+        return 1;
+    }
+
+    size_t first = params.programSpecified ? params.program - 1 : 0;
+    size_t last = params.programSpecified ? params.program : programs.size();
+    bool numbered = last - first > 1;
+
+    msg << "Processing " << (params.inputFileName == "-" ? "stdin" : params.inputFileName) << ":" << endl;
+    msg << "\tFormat:\t\t" << tapeFormatDesc(params.inputFormat).name << endl;
+    if (programs.size() > 1)
+        msg << "\tPrograms:\t" << programs.size() << endl << endl;
+
+    bool csErrors = false;
+    for (size_t i = first; i < last; i++) {
+        const TapeFileInfo& info = programs[i];
+        if (programs.size() > 1)
+            msg << "Program " << i + 1 << ":" << endl;
+        printInfo(info, msg);
+        msg << endl;
+
+        if (info.hasCs && info.storedCs != info.calcCs) {
+            err << "Checksum error" << (programs.size() > 1 ? " (program " + to_string(i + 1) + ")" : "") << ": " <<
+                   setfill('0') << setw(4) << uppercase << hex << info.storedCs << ", calculated " << setw(4) << info.calcCs << dec <<
+                   (params.ignoreCs ? " (ignored)" : "") << endl;
+            csErrors = true;
+        }
+    }
+
+    if (csErrors && !params.ignoreCs)
+        return 1;
+
+    if (params.listOnly)
+        return 0;
+
+    for (const auto& fmt: params.formats)
+        if (numbered && fmt.outputFileName == "-") {
+            err << "Several programs can't be written to stdout, use -p!" << endl;
+            return 1;
+        }
+
+    for (size_t i = first; i < last; i++) {
+        const TapeFileInfo& info = programs[i];
+
+        uint16_t loadAddr = params.loadAddrSpecified ? params.loadAddr : info.loadAddr;
+        uint16_t runAddr = params.runAddrSpecified ? params.runAddr : info.hasRunAddr ? info.runAddr : loadAddr;
+
+        string intFileName = params.intFileSpecified ? params.intFileName : intFileNameStr(info);
+        if (intFileName.empty() && params.inputFileName != "-")
+            intFileName = params.inputFileName.substr(params.inputFileName.find_last_of("/\\:") + 1);
+
+        // the body is written straight from the input data
+        BlockChecksums bodyCs = calcBlockChecksums(info.body, info.bodySize);
+
+        for (const auto& fmt: params.formats) {
+            string outputFileName = numbered ? programFileName(fmt.outputFileName, i + 1) : fmt.outputFileName;
+
+            msg << "Writing " << (outputFileName == "-" ? "stdout" : outputFileName) << " ... ";
+
+            bool ok;
+            if (fmt.bin) {
+                OutputChunk chunk = {info.body, info.bodySize};
+                ok = writeChunks(outputFileName, &chunk, 1);
+            } else {
+                Bin2TapeOptions options = {fmt.format, loadAddr, runAddr, intFileName.c_str()};
+                TapeImage image;
+                bin2tapeImage(info.bodySize, bodyCs, options, image);
+                ok = writeTapeFile(outputFileName, image, info.body, info.bodySize);
+            }
+
+            if (!ok) {
+                msg << "error!" << endl;
+                err << "Error writing " << outputFileName << endl;
+                return 1;
+            }
+
+            msg << "done." << endl;
+        }
+    }
+
+    return 0;
+}
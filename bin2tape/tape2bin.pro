@@ -0,0 +1,20 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG -= qt
+
+SOURCES += \
+    tape2bin.cpp \
+    checksum.cpp \
+    fileio.cpp \
+    tapeformat.cpp \
+    libbin2tape.cpp
+
+HEADERS += \
+    bin2tape.h \
+    checksum.h \
+    fileio.h \
+    tapeformat.h \
+    libbin2tape.h
+
+QMAKE_LFLAGS += -static -static-libgcc
@@ -0,0 +1,316 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#include <algorithm>
+
+#include <cstring>
+#include <cstddef>
+
+#include "tapeaudio.h"
+#include "fileio.h"
+
+using namespace std;
+
+
+static const uint8_t levelHigh = 0xE0;
+static const uint8_t levelLow = 0x20;
+static const uint8_t levelSilence = 0x80;
+
+static const int phaseBaudRate = 1200;      // RK86 compatible monitors adjust to the speed by the pilot tone
+static const int phasePilotBytes = 256;
+static const int fskLongPilot = 8000;       // 2400 Hz periods before the first block
+static const int fskShortPilot = 2000;      // and before the next ones
+
+static const size_t wavHeaderSize = 44;
+
+
+static TapeModulation tapeModulation(TapeFileFormat format)
+{
+    switch (tapeFormatDesc(format).headerLayout) {
+    case THL_RK:
+    case THL_RKO:
+        return TM_PHASE;
+    case THL_CAS:
+    case THL_LVT:
+        return TM_FSK;
+    default:
+        return TM_NONE; // BRU is a disk file format
+    }
+}
+
+
+bool TapeAudioRenderer::isSupported(TapeFileFormat format)
+{
+    return tapeModulation(format) != TM_NONE;
+}
+
+
+TapeAudioRenderer::TapeAudioRenderer(TapeFileFormat format, int sampleRate)
+{
+    m_format = format;
+    m_modulation = tapeModulation(format);
+    m_sampleRate = sampleRate;
+
+    buildTables();
+}
+
+
+void TapeAudioRenderer::buildTables()
+{
+    m_byteSamples = 0;
+    m_byteTable.clear();
+    m_pilotUnit.clear();
+
+    if (m_modulation == TM_PHASE) {
+        // every bit is two half periods, the level of the second one is the bit value
+        int halfBit = max(1, (m_sampleRate + phaseBaudRate) / (phaseBaudRate * 2));
+        m_byteSamples = halfBit * 2 * 8;
+        m_byteTable.resize(m_byteSamples * 256);
+
+        for (int value = 0; value < 256; value++) {
+            uint8_t* p = m_byteTable.data() + value * m_byteSamples;
+            for (int bit = 7; bit >= 0; bit--) {
+                bool one = value & (1 << bit);
+                p = static_cast<uint8_t*>(memset(p, one ? levelLow : levelHigh, halfBit)) + halfBit;
+                p = static_cast<uint8_t*>(memset(p, one ? levelHigh : levelLow, halfBit)) + halfBit;
+            }
+        }
+
+        // the pilot tone is a sequence of zero bytes
+        m_pilotUnit.assign(m_byteTable.begin(), m_byteTable.begin() + m_byteSamples);
+    } else if (m_modulation == TM_FSK) {
+        // half period of 2400 Hz, 1200 Hz half period is twice as long so that all bits have the same length
+        int half = max(1, (m_sampleRate + 2400) / 4800);
+        int bitSamples = half * 4;
+        m_byteSamples = bitSamples * 11;
+        m_byteTable.resize(m_byteSamples * 256);
+
+        for (int value = 0; value < 256; value++) {
+            uint8_t* p = m_byteTable.data() + value * m_byteSamples;
+            int frame = (value << 1) | 0x600; // start bit, 8 data bits, 2 stop bits
+            for (int bit = 0; bit < 11; bit++) {
+                int halfLen = frame & (1 << bit) ? half : half * 2;
+                for (int i = 0; i < bitSamples; i += halfLen * 2) {
+                    p = static_cast<uint8_t*>(memset(p, levelHigh, halfLen)) + halfLen;
+                    p = static_cast<uint8_t*>(memset(p, levelLow, halfLen)) + halfLen;
+                }
+            }
+        }
+
+        m_pilotUnit.resize(half * 2);
+        memset(m_pilotUnit.data(), levelHigh, half);
+        memset(m_pilotUnit.data() + half, levelLow, half);
+    }
+}
+
+
+// Splits the tape image into the blocks as they are recorded on tape, the segments are appended
+void TapeAudioRenderer::makeSegments(const TapeImage& image, const uint8_t* body, size_t bodySize, vector<Segment>& segments) const
+{
+    const uint8_t* header = image.headerData();
+    size_t gap = m_sampleRate / 2;
+
+    auto add = [&](Segment::Type type, const uint8_t* data, size_t count, uint8_t value) {
+        Segment segment;
+        segment.type = type;
+        segment.data = data;
+        segment.count = count;
+        segment.value = value;
+        segments.push_back(segment);
+    };
+
+    add(Segment::ST_SILENCE, nullptr, gap, 0);
+
+    switch (tapeFormatDesc(m_format).headerLayout) {
+    case THL_RK:
+        add(Segment::ST_PILOT, nullptr, phasePilotBytes, 0);
+        add(Segment::ST_FILL, nullptr, 1, 0xE6);
+        add(Segment::ST_BYTES, header, image.headerSize, 0);
+        add(Segment::ST_BYTES, body, bodySize, 0);
+        add(Segment::ST_BYTES, image.footerData(), image.footerSize, 0);
+        break;
+    case THL_RKO:
+        // the name is kept by emulators only, the rest of the header starts with its own null bytes and sync byte
+        add(Segment::ST_PILOT, nullptr, phasePilotBytes, 0);
+        add(Segment::ST_BYTES, header + sizeof(image.header.rkoHeader.name), image.headerSize - sizeof(image.header.rkoHeader.name), 0);
+        add(Segment::ST_BYTES, body, bodySize, 0);
+        add(Segment::ST_BYTES, image.footerData(), image.footerSize, 0);
+        break;
+    case THL_CAS:
+        // the signatures mark the blocks, each of them is preceded by a pilot tone
+        add(Segment::ST_PILOT, nullptr, fskLongPilot, 0);
+        add(Segment::ST_BYTES, header + offsetof(CasHeader, d0), offsetof(CasHeader, casSignature2) - offsetof(CasHeader, d0), 0);
+        add(Segment::ST_SILENCE, nullptr, gap, 0);
+        add(Segment::ST_PILOT, nullptr, fskShortPilot, 0);
+        add(Segment::ST_BYTES, header + offsetof(CasHeader, loadAddrLo), image.headerSize - offsetof(CasHeader, loadAddrLo), 0);
+        add(Segment::ST_BYTES, body, bodySize, 0);
+        break;
+    case THL_LVT:
+        // the signature stands for the first 9 of the 10 D0 bytes of the name block
+        add(Segment::ST_PILOT, nullptr, fskLongPilot, 0);
+        add(Segment::ST_FILL, nullptr, 9, 0xD0);
+        add(Segment::ST_BYTES, header + offsetof(LvtHeader, d0), offsetof(LvtHeader, loadAddrLo) - offsetof(LvtHeader, d0), 0);
+        add(Segment::ST_SILENCE, nullptr, gap, 0);
+        add(Segment::ST_PILOT, nullptr, fskShortPilot, 0);
+        add(Segment::ST_BYTES, header + offsetof(LvtHeader, loadAddrLo), image.headerSize - offsetof(LvtHeader, loadAddrLo), 0);
+        add(Segment::ST_BYTES, body, bodySize, 0);
+        break;
+    default:
+        break;
+    }
+
+    add(Segment::ST_SILENCE, nullptr, gap, 0);
+}
+
+
+size_t TapeAudioRenderer::pcmSize(const vector<Segment>& segments) const
+{
+    size_t size = 0;
+
+    for (const auto& segment: segments)
+        switch (segment.type) {
+        case Segment::ST_SILENCE:
+            size += segment.count;
+            break;
+        case Segment::ST_PILOT:
+            size += segment.count * m_pilotUnit.size();
+            break;
+        case Segment::ST_BYTES:
+        case Segment::ST_FILL:
+            size += segment.count * m_byteSamples;
+            break;
+        }
+
+    return size;
+}
+
+
+size_t TapeAudioRenderer::wavSize(const TapeImage& image, size_t bodySize) const
+{
+    vector<Segment> segments;
+    makeSegments(image, nullptr, bodySize, segments);
+
+    size_t dataSize = pcmSize(segments);
+    return wavHeaderSize + dataSize + (dataSize & 1);
+}
+
+
+double TapeAudioRenderer::playTime(const TapeImage& image, size_t bodySize) const
+{
+    vector<Segment> segments;
+    makeSegments(image, nullptr, bodySize, segments);
+
+    return double(pcmSize(segments)) / m_sampleRate;
+}
+
+
+static void put32(uint8_t* p, uint32_t value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = value >> 24;
+}
+
+
+bool TapeAudioRenderer::writeWav(const string& fileName, const TapeImage& image, const uint8_t* body, size_t bodySize) const
+{
+    TapeProgram program = {image, body, bodySize};
+    return writeWav(fileName, &program, 1);
+}
+
+
+bool TapeAudioRenderer::writeWav(const string& fileName, const TapeProgram* programs, size_t nPrograms) const
+{
+    if (m_modulation == TM_NONE)
+        return false;
+
+    // every program is surrounded by silence, so there is a pause between the programs
+    vector<Segment> segments;
+    for (size_t i = 0; i < nPrograms; i++)
+        makeSegments(programs[i].image, programs[i].body, programs[i].bodySize, segments);
+    uint32_t dataSize = pcmSize(segments);
+
+    // the sizes are known in advance, so the header is written first and the output doesn't need to be seekable
+    uint8_t wavHeader[wavHeaderSize] = {
+        'R', 'I', 'F', 'F',  0, 0, 0, 0,  'W', 'A', 'V', 'E',
+        'f', 'm', 't', ' ',  16, 0, 0, 0,  1, 0 /* PCM */,  1, 0 /* mono */,  0, 0, 0, 0,  0, 0, 0, 0,  1, 0,  8, 0,
+        'd', 'a', 't', 'a',  0, 0, 0, 0
+    };
+    bool padding = dataSize & 1; // RIFF chunks are word aligned
+    put32(wavHeader + 4, wavHeaderSize - 8 + dataSize + padding);
+    put32(wavHeader + 24, m_sampleRate);
+    put32(wavHeader + 28, m_sampleRate); // bytes per second
+    put32(wavHeader + 40, dataSize);
+
+    OutputFile file;
+    if (!file.open(fileName))
+        return false;
+
+    file.write(wavHeader, sizeof(wavHeader));
+
+    const size_t bufSize = 0x10000;
+    vector<uint8_t> buf(bufSize);
+    size_t bufPos = 0;
+
+    // every piece is not longer than a byte waveform, so it always fits into the buffer after a flush
+    auto put = [&](const uint8_t* samples, size_t len) {
+        if (bufPos + len > bufSize) {
+            file.write(buf.data(), bufPos);
+            bufPos = 0;
+        }
+        memcpy(buf.data() + bufPos, samples, len);
+        bufPos += len;
+    };
+
+    for (const auto& segment: segments) {
+        switch (segment.type) {
+        case Segment::ST_SILENCE: {
+            vector<uint8_t> silence(m_byteSamples, levelSilence);
+            for (size_t left = segment.count; left; ) {
+                size_t len = min(left, silence.size());
+                put(silence.data(), len);
+                left -= len;
+            }
+            break;
+        }
+        case Segment::ST_PILOT:
+            for (size_t j = 0; j < segment.count; j++)
+                put(m_pilotUnit.data(), m_pilotUnit.size());
+            break;
+        case Segment::ST_BYTES:
+            for (size_t j = 0; j < segment.count; j++)
+                put(m_byteTable.data() + segment.data[j] * m_byteSamples, m_byteSamples);
+            break;
+        case Segment::ST_FILL:
+            for (size_t j = 0; j < segment.count; j++)
+                put(m_byteTable.data() + segment.value * m_byteSamples, m_byteSamples);
+            break;
+        }
+    }
+
+    if (padding)
+        put(&levelSilence, 1);
+
+    file.write(buf.data(), bufPos);
+
+    return file.close();
+}
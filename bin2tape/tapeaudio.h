@@ -0,0 +1,93 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#ifndef TAPEAUDIO_H
+#define TAPEAUDIO_H
+
+#include <string>
+#include <vector>
+
+#include "tapeformat.h"
+
+
+// Tape audio (WAV, 8-bit mono PCM) renderer.
+//
+// The waveform of every byte value is precomputed for the format and sample rate when the
+// renderer is constructed, rendering is then a sequence of table copies into a fixed size
+// buffer which is flushed to the output file, so the whole PCM data is never kept in memory.
+
+enum TapeModulation {
+    TM_NONE,    // not a tape format
+    TM_PHASE,   // RK86 style phase (Manchester) encoding, MSB first
+    TM_FSK      // MSX style FSK: 0 - one 1200 Hz period, 1 - two 2400 Hz periods, start and 2 stop bits, LSB first
+};
+
+
+class TapeAudioRenderer
+{
+public:
+    static const int defaultSampleRate = 44100;
+
+    TapeAudioRenderer(TapeFileFormat format, int sampleRate = defaultSampleRate);
+
+    static bool isSupported(TapeFileFormat format);
+
+    // size of the WAV file including the header
+    size_t wavSize(const TapeImage& image, size_t bodySize) const;
+
+    // duration of the tape signal in seconds
+    double playTime(const TapeImage& image, size_t bodySize) const;
+
+    bool writeWav(const std::string& fileName, const TapeImage& image, const uint8_t* body, size_t bodySize) const;
+
+    // several programs one after another on the same tape
+    bool writeWav(const std::string& fileName, const TapeProgram* programs, size_t nPrograms) const;
+
+private:
+    // a part of the tape signal
+    struct Segment {
+        enum Type {
+            ST_SILENCE, // count samples of silence
+            ST_PILOT,   // count pilot tone units
+            ST_BYTES,   // size bytes of data
+            ST_FILL     // count copies of the byte value
+        };
+
+        Type type;
+        const uint8_t* data;
+        size_t count;
+        uint8_t value;
+    };
+
+    TapeFileFormat m_format;
+    TapeModulation m_modulation;
+    int m_sampleRate;
+
+    int m_byteSamples;                  // samples per byte
+    std::vector<uint8_t> m_byteTable;   // 256 waveforms of m_byteSamples samples
+    std::vector<uint8_t> m_pilotUnit;   // one unit of the pilot tone
+
+    void buildTables();
+    void makeSegments(const TapeImage& image, const uint8_t* body, size_t bodySize, std::vector<Segment>& segments) const;
+    size_t pcmSize(const std::vector<Segment>& segments) const;
+};
+
+#endif // TAPEAUDIO_H
@@ -0,0 +1,569 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+
+#include "tapeformat.h"
+
+
+using namespace std;
+
+
+bool parseFormat(const string& value, TapeFileFormat& format)
+{
+    if (value == "rk" || value == "rkr" || value == "rka" || value == "rk8" || value == "rke" || value == "rkl")
+        format = TFF_RK;
+    else if (value == "rkm")
+        format = TFF_RKM;
+    else if (value == "rku")
+        format = TFF_RKU;
+    else if (value == "rks")
+        format = TFF_RKS;
+    else if (value == "rko")
+        format = TFF_RKO;
+    else if (value == "bru" || value == "ord")
+        format = TFF_BRU;
+    else if (value == "rkp")
+        format = TFF_RKP;
+    else if (value == "rk4")
+        format = TFF_RK4;
+    else if (value == "cas")
+        format = TFF_CAS;
+    else if (value == "lvt")
+        format = TFF_LVT;
+    else
+        return false;
+
+    return true;
+}
+
+
+int intFileNameLength(TapeFileFormat format)
+{
+    return tapeFormatDesc(format).nameLength;
+}
+
+
+void makeIntName(const char* baseName, int len, uint8_t* intName)
+{
+    int i = 0;
+    while (i < len) {
+        char ch = baseName[i];
+
+        // cut off the extention if any
+        if (!ch || ch == '.')
+            break;
+
+        if ((ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || ch == ' ')
+            ch = ch >= 'a' && ch <= 'z' ? ch - 0x20 : ch;
+        else
+            ch = '-';
+
+        intName[i] = uint8_t(ch);
+
+        ++i;
+    }
+
+    while (i < len)
+        intName[i++] = 0x20;
+}
+
+
+void makeIntName(const string& baseName, int len, uint8_t* intName)
+{
+    makeIntName(baseName.c_str(), len, intName);
+}
+
+
+// Tape image writers.
+//
+// A writer is instantiated for every format from its descriptor: the header is filled in by the emitter
+// for the header layout, the checksum and the footer shape are compile-time constants, so each instance
+// is a straight sequence of stores without any checks of the format.
+
+template <bool BigEndian>
+static inline void put16(uint8_t* p, uint16_t value)
+{
+    p[BigEndian ? 1 : 0] = value & 0xFF;
+    p[BigEndian ? 0 : 1] = value >> 8;
+}
+
+
+template <TapeHeaderLayout Layout>
+struct TapeHeaderEmitter;
+
+
+template <>
+struct TapeHeaderEmitter<THL_RK>
+{
+    template <bool BigEndian>
+    static void emit(FileHeader& header, uint16_t loadAddr, uint16_t endAddr, uint16_t, const uint8_t*)
+    {
+        uint8_t* p = reinterpret_cast<uint8_t*>(&header.rkHeader);
+        put16<BigEndian>(p, loadAddr);
+        put16<BigEndian>(p + 2, endAddr);
+    }
+};
+
+
+static void fillBruHeader(BruHeader& header, uint16_t loadAddr, uint16_t len, const uint8_t* intFileName)
+{
+    memcpy(header.name, intFileName, 8);
+    header.loadAddrHi = loadAddr >> 8;
+    header.loadAddrLo = loadAddr & 0xFF;
+    header.lenHi = len >> 8;
+    header.lenLo = len & 0xFF;
+    header.attr = 0;
+    memset(header.ff, 0xFF, sizeof(header.ff));
+}
+
+
+template <>
+struct TapeHeaderEmitter<THL_BRU>
+{
+    template <bool>
+    static void emit(FileHeader& header, uint16_t loadAddr, uint16_t endAddr, uint16_t, const uint8_t* intFileName)
+    {
+        fillBruHeader(header.bruHeader, loadAddr, endAddr - loadAddr + 1, intFileName);
+    }
+};
+
+
+template <>
+struct TapeHeaderEmitter<THL_RKO>
+{
+    template <bool>
+    static void emit(FileHeader& header, uint16_t loadAddr, uint16_t endAddr, uint16_t, const uint8_t* intFileName)
+    {
+        RkoHeader& rkoHeader = header.rkoHeader;
+        memcpy(rkoHeader.name, intFileName, 8);
+        memset(rkoHeader.nullBytes, 0, sizeof(rkoHeader.nullBytes));
+        rkoHeader.syncByte = 0xE6;
+        rkoHeader.loadAddrHi = loadAddr >> 8;
+        rkoHeader.loadAddrLo = loadAddr & 0xFF;
+        rkoHeader.lenHi = uint16_t(endAddr - loadAddr + 1 + 16) >> 8;
+        rkoHeader.lenLo = (endAddr - loadAddr + 1 + 16) & 0xFF;
+        fillBruHeader(rkoHeader.bruHeader, loadAddr, endAddr - loadAddr + 1, intFileName);
+    }
+};
+
+
+template <>
+struct TapeHeaderEmitter<THL_CAS>
+{
+    template <bool>
+    static void emit(FileHeader& header, uint16_t loadAddr, uint16_t endAddr, uint16_t runAddr, const uint8_t* intFileName)
+    {
+        CasHeader& casHeader = header.casHeader;
+        memcpy(casHeader.casSignature1, casSignature, sizeof(casHeader.casSignature1));
+        memset(casHeader.d0, 0xD0, sizeof(casHeader.d0));
+        memcpy(casHeader.name, intFileName, 6);
+        memset(casHeader.padding, 0, sizeof(casHeader.padding));
+        memcpy(casHeader.casSignature2, casSignature, sizeof(casHeader.casSignature2));
+        put16<false>(&casHeader.loadAddrLo, loadAddr);
+        put16<false>(&casHeader.endAddrLo, endAddr);
+        put16<false>(&casHeader.runAddrLo, runAddr);
+    }
+};
+
+
+template <>
+struct TapeHeaderEmitter<THL_LVT>
+{
+    template <bool>
+    static void emit(FileHeader& header, uint16_t loadAddr, uint16_t endAddr, uint16_t runAddr, const uint8_t* intFileName)
+    {
+        LvtHeader& lvtHeader = header.lvtHeader;
+        memcpy(lvtHeader.lvtSignature, lvtSignature, sizeof(lvtHeader.lvtSignature));
+        lvtHeader.d0 = 0xD0;
+        memcpy(lvtHeader.name, intFileName, 6);
+        put16<false>(&lvtHeader.loadAddrLo, loadAddr);
+        put16<false>(&lvtHeader.endAddrLo, endAddr);
+        put16<false>(&lvtHeader.runAddrLo, runAddr);
+    }
+};
+
+
+template <TapeChecksumType Checksum>
+static inline uint16_t tapeChecksum(const BlockChecksums& bodyCs, const FileHeader& header);
+
+template <>
+inline uint16_t tapeChecksum<TCT_NONE>(const BlockChecksums&, const FileHeader&)
+{
+    return 0;
+}
+
+template <>
+inline uint16_t tapeChecksum<TCT_RK>(const BlockChecksums& bodyCs, const FileHeader&)
+{
+    return bodyCs.rkCs;
+}
+
+template <>
+inline uint16_t tapeChecksum<TCT_RKM>(const BlockChecksums& bodyCs, const FileHeader&)
+{
+    return bodyCs.rkmCs;
+}
+
+template <>
+inline uint16_t tapeChecksum<TCT_RKU>(const BlockChecksums& bodyCs, const FileHeader&)
+{
+    return bodyCs.rkuCs;
+}
+
+template <>
+inline uint16_t tapeChecksum<TCT_RKO>(const BlockChecksums& bodyCs, const FileHeader& header)
+{
+    static const uint8_t padding[3] = {0, 0, 0};
+    uint16_t cs = addToRkCs(0, reinterpret_cast<const uint8_t*>(&header.rkoHeader.bruHeader), sizeof(BruHeader), false);
+    cs = addToRkCs(cs, bodyCs);
+    return addToRkCs(cs, padding, 3, true);
+}
+
+
+template <TapeFileFormat Format>
+static void emitTapeImage(size_t bodySize, const BlockChecksums& bodyCs, uint16_t loadAddr, uint16_t runAddr,
+                          const uint8_t* intFileName, TapeImage& image)
+{
+    constexpr const TapeFormatDesc& desc = tapeFormatDescs[Format];
+    static_assert(desc.format == Format, "tapeFormatDescs must be ordered by TapeFileFormat");
+    static_assert(desc.footerNullBytes + desc.bodyAlign + 1 + desc.checksumCopies * 2 <= int(sizeof(image.footer)), "Footer is too large");
+
+    image.headerSize = desc.headerSize;
+    TapeHeaderEmitter<desc.headerLayout>::template emit<desc.bigEndian>(image.header, loadAddr, loadAddr + bodySize - 1, runAddr, intFileName);
+
+    uint16_t cs = tapeChecksum<desc.checksum>(bodyCs, image.header);
+
+    int nullBytes = tapeFooterNullBytes(desc, bodySize);
+
+    uint8_t* p = image.footer;
+    memset(p, 0, nullBytes);
+    p += nullBytes;
+    if (desc.footerSyncByte)
+        *p++ = 0xE6;
+    for (int i = 0; i < desc.checksumCopies; i++, p += 2)
+        put16<desc.bigEndian>(p, cs);
+
+    image.footerSize = p - image.footer;
+}
+
+
+typedef void (*TapeImageEmitter)(size_t bodySize, const BlockChecksums& bodyCs, uint16_t loadAddr, uint16_t runAddr,
+                                 const uint8_t* intFileName, TapeImage& image);
+
+static const TapeImageEmitter tapeImageEmitters[] = {
+    emitTapeImage<TFF_RK>, emitTapeImage<TFF_RKP>, emitTapeImage<TFF_RKM>, emitTapeImage<TFF_RKU>, emitTapeImage<TFF_RK4>,
+    emitTapeImage<TFF_RKS>, emitTapeImage<TFF_RKO>, emitTapeImage<TFF_BRU>, emitTapeImage<TFF_CAS>, emitTapeImage<TFF_LVT>
+};
+
+static_assert(sizeof(tapeImageEmitters) / sizeof(tapeImageEmitters[0]) == sizeof(tapeFormatDescs) / sizeof(tapeFormatDescs[0]),
+              "Every format in tapeFormatDescs needs an emitter");
+
+
+void buildTapeImage(TapeFileFormat format, size_t bodySize, const BlockChecksums& bodyCs, uint16_t loadAddr, uint16_t startAddr,
+                    const uint8_t* intFileName, TapeImage& image)
+{
+    tapeImageEmitters[format](bodySize, bodyCs, loadAddr, startAddr, intFileName, image);
+}
+
+
+// The address space wraps around, so a block loaded high may end below its load address
+static size_t bodySizeFromAddrs(int loadAddr, int endAddr)
+{
+    return ((endAddr - loadAddr) & 0xFFFF) + 1;
+}
+
+
+// Skips null bytes after the body and checks the sync byte, returns the position of the checksum or 0
+static size_t findRkSyncByte(const uint8_t* data, size_t size, size_t pos, size_t maxNullBytes)
+{
+    size_t limit = pos + maxNullBytes;
+    while (pos < size && pos < limit && data[pos] == 0)
+        pos++;
+
+    if (pos >= size || data[pos] != 0xE6)
+        return 0;
+
+    return pos + 1;
+}
+
+
+static uint16_t get16(const uint8_t* p, bool bigEndian)
+{
+    return bigEndian ? (p[0] << 8) | p[1] : p[0] | (p[1] << 8);
+}
+
+
+// all THL_RK formats
+static TapeDecodeResult decodeRk(const uint8_t* data, size_t size, TapeFileFormat format, TapeFileInfo& info)
+{
+    const TapeFormatDesc& desc = tapeFormatDesc(format);
+
+    if (size < size_t(desc.headerSize))
+        return TDR_TRUNCATED;
+
+    int loadAddr = get16(data, desc.bigEndian);
+    int endAddr = get16(data + 2, desc.bigEndian);
+
+    info.loadAddr = loadAddr;
+    info.runAddr = loadAddr;
+    info.body = data + desc.headerSize;
+    info.bodySize = bodySizeFromAddrs(loadAddr, endAddr);
+
+    size_t pos = desc.headerSize + info.bodySize;
+    if (pos > size)
+        return TDR_TRUNCATED;
+
+    if (desc.footerSyncByte) {
+        // the number of null bytes differs between the formats and tape software, some files have none
+        size_t csPos = findRkSyncByte(data, size, pos, sizeof(Rk4Footer::nullBytes));
+        if (!csPos)
+            return pos + desc.footerNullBytes + 3 > size ? TDR_TRUNCATED : TDR_BAD_FORMAT;
+        pos = csPos;
+    }
+
+    if (pos + 2 > size)
+        return TDR_TRUNCATED;
+
+    // the copies of the checksum aren't checked
+    info.size = min(pos + 2 * desc.checksumCopies, size);
+    info.hasCs = true;
+    info.storedCs = get16(data + pos, desc.bigEndian);
+
+    BlockChecksums bodyCs = calcBlockChecksums(info.body, info.bodySize);
+    info.calcCs = desc.checksum == TCT_RKM ? bodyCs.rkmCs : desc.checksum == TCT_RKU ? bodyCs.rkuCs : bodyCs.rkCs;
+
+    return info.storedCs == info.calcCs ? TDR_OK : TDR_BAD_CHECKSUM;
+}
+
+
+static TapeDecodeResult decodeRko(const uint8_t* data, size_t size, TapeFileInfo& info)
+{
+    if (size < sizeof(RkoHeader))
+        return TDR_TRUNCATED;
+
+    const RkoHeader* header = reinterpret_cast<const RkoHeader*>(data);
+    if (header->syncByte != 0xE6)
+        return TDR_BAD_FORMAT;
+
+    const BruHeader& bruHeader = header->bruHeader;
+    info.loadAddr = bruHeader.loadAddrLo | (bruHeader.loadAddrHi << 8);
+    info.runAddr = info.loadAddr;
+    info.body = data + sizeof(RkoHeader);
+    info.bodySize = bruHeader.lenLo | (bruHeader.lenHi << 8);
+    info.intFileNameLen = 8;
+    memcpy(info.intFileName, header->name, 8);
+
+    size_t pos = sizeof(RkoHeader) + info.bodySize;
+    if (pos > size)
+        return TDR_TRUNCATED;
+
+    size_t csPos = findRkSyncByte(data, size, pos, sizeof(RkoFooter::padding));
+    if (!csPos)
+        return pos + 3 > size ? TDR_TRUNCATED : TDR_BAD_FORMAT;
+    if (csPos + 2 > size)
+        return TDR_TRUNCATED;
+
+    info.size = csPos + 2;
+
+    // the checksum covers the BRU header, the body and 3 padding bytes (see buildTapeImage())
+    static const uint8_t padding[3] = {0, 0, 0};
+    uint16_t cs = addToRkCs(0, reinterpret_cast<const uint8_t*>(&bruHeader), sizeof(BruHeader), false);
+    cs = addToRkCs(cs, info.body, info.bodySize, false);
+    cs = addToRkCs(cs, padding, 3, true);
+
+    info.hasCs = true;
+    info.storedCs = (data[csPos] << 8) | data[csPos + 1];
+    info.calcCs = cs;
+
+    return info.storedCs == info.calcCs ? TDR_OK : TDR_BAD_CHECKSUM;
+}
+
+
+static TapeDecodeResult decodeBru(const uint8_t* data, size_t size, TapeFileInfo& info)
+{
+    if (size < sizeof(BruHeader))
+        return TDR_TRUNCATED;
+
+    const BruHeader* header = reinterpret_cast<const BruHeader*>(data);
+    info.loadAddr = header->loadAddrLo | (header->loadAddrHi << 8);
+    info.runAddr = info.loadAddr;
+    info.body = data + sizeof(BruHeader);
+    info.bodySize = header->lenLo | (header->lenHi << 8);
+    info.intFileNameLen = 8;
+    memcpy(info.intFileName, header->name, 8);
+    info.size = sizeof(BruHeader) + info.bodySize;
+
+    return info.size > size ? TDR_TRUNCATED : TDR_OK;
+}
+
+
+static TapeDecodeResult decodeCas(const uint8_t* data, size_t size, TapeFileInfo& info)
+{
+    if (size < sizeof(CasHeader))
+        return TDR_TRUNCATED;
+
+    const CasHeader* header = reinterpret_cast<const CasHeader*>(data);
+    if (memcmp(header->casSignature1, casSignature, sizeof(casSignature)) || header->d0[0] != 0xD0)
+        return TDR_BAD_FORMAT;
+
+    info.intFileNameLen = 6;
+    memcpy(info.intFileName, header->name, 6);
+
+    // the second block starts at the next 8-byte boundary after the name, bin2tape adds 8 more bytes of padding
+    size_t pos = offsetof(CasHeader, padding);
+    while (pos + sizeof(casSignature) <= offsetof(CasHeader, casSignature2) && memcmp(data + pos, casSignature, sizeof(casSignature)))
+        pos += 8;
+    if (memcmp(data + pos, casSignature, sizeof(casSignature)))
+        return TDR_BAD_FORMAT;
+    pos += sizeof(casSignature);
+
+    if (pos + 6 > size)
+        return TDR_TRUNCATED;
+
+    int loadAddr = data[pos] | (data[pos + 1] << 8);
+    int endAddr = data[pos + 2] | (data[pos + 3] << 8);
+    info.loadAddr = loadAddr;
+    info.runAddr = data[pos + 4] | (data[pos + 5] << 8);
+    info.hasRunAddr = true;
+    info.body = data + pos + 6;
+    info.bodySize = bodySizeFromAddrs(loadAddr, endAddr);
+    info.size = pos + 6 + info.bodySize;
+
+    return info.size > size ? TDR_TRUNCATED : TDR_OK;
+}
+
+
+static TapeDecodeResult decodeLvt(const uint8_t* data, size_t size, TapeFileInfo& info)
+{
+    if (size < sizeof(LvtHeader))
+        return TDR_TRUNCATED;
+
+    const LvtHeader* header = reinterpret_cast<const LvtHeader*>(data);
+    if (memcmp(header->lvtSignature, lvtSignature, sizeof(lvtSignature)))
+        return TDR_BAD_FORMAT;
+
+    int loadAddr = header->loadAddrLo | (header->loadAddrHi << 8);
+    int endAddr = header->endAddrLo | (header->endAddrHi << 8);
+    info.loadAddr = loadAddr;
+    info.runAddr = header->runAddrLo | (header->runAddrHi << 8);
+    info.hasRunAddr = true;
+    info.body = data + sizeof(LvtHeader);
+    info.bodySize = bodySizeFromAddrs(loadAddr, endAddr);
+    info.intFileNameLen = 6;
+    memcpy(info.intFileName, header->name, 6);
+    info.size = sizeof(LvtHeader) + info.bodySize;
+
+    return info.size > size ? TDR_TRUNCATED : TDR_OK;
+}
+
+
+TapeDecodeResult decodeTape(const uint8_t* data, size_t size, TapeFileFormat format, TapeFileInfo& info)
+{
+    memset(&info, 0, sizeof(info));
+    info.format = format;
+
+    switch (tapeFormatDesc(format).headerLayout) {
+    case THL_RK: {
+        TapeDecodeResult res = decodeRk(data, size, format, info);
+        // some RK files start with the sync byte
+        if (res != TDR_OK && size && data[0] == 0xE6) {
+            TapeFileInfo info2 = info;
+            if (decodeRk(data + 1, size - 1, format, info2) == TDR_OK) {
+                info = info2;
+                info.size++;
+                res = TDR_OK;
+            }
+        }
+        return res;
+    }
+    case THL_RKO:
+        return decodeRko(data, size, info);
+    case THL_BRU:
+        return decodeBru(data, size, info);
+    case THL_CAS:
+        return decodeCas(data, size, info);
+    case THL_LVT:
+        return decodeLvt(data, size, info);
+    }
+
+    return TDR_BAD_FORMAT;
+}
+
+
+TapeDecodeResult decodeTapeContainer(const uint8_t* data, size_t size, TapeFileFormat format, vector<TapeFileInfo>& programs,
+                                     size_t& errorProgram)
+{
+    programs.clear();
+    errorProgram = 0;
+
+    TapeDecodeResult firstRes = TDR_OK;
+    size_t align = containerAlign(format);
+    size_t pos = 0;
+
+    for (;;) {
+        TapeFileInfo info;
+        TapeDecodeResult res = decodeTape(data + pos, size - pos, format, info);
+        programs.push_back(info);
+
+        if (res != TDR_OK && firstRes == TDR_OK) {
+            firstRes = res;
+            errorProgram = programs.size() - 1;
+        }
+        if ((res != TDR_OK && res != TDR_BAD_CHECKSUM) || !isContainerFormat(format))
+            break;
+
+        // the next program starts at the alignment boundary, the zeroes after the last one are padding
+        pos += (info.size + align - 1) / align * align;
+        size_t nonZero = pos;
+        while (nonZero < size && !data[nonZero])
+            nonZero++;
+        if (nonZero >= size)
+            break;
+    }
+
+    return firstRes;
+}
+
+
+bool detectTapeFormat(const uint8_t* data, size_t size, TapeFileFormat& format)
+{
+    TapeFileInfo info;
+
+    // formats with signatures first, then the ones recognized by the checksum only
+    const TapeFileFormat formats[] = {TFF_CAS, TFF_LVT, TFF_RKO, TFF_RK, TFF_RKU, TFF_RKM, TFF_RKS};
+
+    for (TapeFileFormat fmt: formats)
+        if (decodeTape(data, size, fmt, info) == TDR_OK) {
+            format = fmt;
+            return true;
+        }
+
+    // BRU has neither a signature nor a checksum, accept it only if the size matches exactly
+    if (decodeTape(data, size, TFF_BRU, info) == TDR_OK && sizeof(BruHeader) + info.bodySize == size) {
+        format = TFF_BRU;
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,176 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#ifndef TAPEFORMAT_H
+#define TAPEFORMAT_H
+
+#include <string>
+#include <vector>
+
+#include "bin2tape.h"
+#include "checksum.h"
+
+
+// Format descriptors. Everything that differs between the formats is described here,
+// the writers are instantiated from the descriptors at compile time (see tapeformat.cpp).
+
+enum TapeHeaderLayout {
+    THL_RK,     // load and end address (RK, RKS)
+    THL_BRU,    // name, load address, length, attributes
+    THL_RKO,    // name, BRU header
+    THL_CAS,
+    THL_LVT
+};
+
+
+enum TapeChecksumType {
+    TCT_NONE,
+    TCT_RK,     // sum of bytes * 257, the last byte is added to the low byte only
+    TCT_RKM,    // XOR of 16-bit words
+    TCT_RKU,    // sum of bytes
+    TCT_RKO     // RK checksum of the BRU header, body and 3 padding bytes
+};
+
+
+struct TapeFormatDesc {
+    TapeFileFormat format;
+    const char* name;
+    TapeHeaderLayout headerLayout;
+    int headerSize;
+    bool bigEndian;             // byte order of addresses in THL_RK header and of the checksum
+    TapeChecksumType checksum;
+    int footerNullBytes;        // null bytes before the sync byte
+    int bodyAlign;              // header + body + footer null bytes are padded to this size (0 = no padding)
+    bool footerSyncByte;
+    int checksumCopies;
+    int nameLength;
+    bool hasRunAddr;
+};
+
+
+constexpr TapeFormatDesc tapeFormatDescs[] = {
+    // format  name                   header   header size        big e. checksum  nulls align sync   cs  name run
+    {TFF_RK,  "RK compatible",       THL_RK,  sizeof(RkHeader),  true,  TCT_RK,   2,    0,    true,  1,  0,   false},
+    {TFF_RKP, "RKP (RK compatible)", THL_RK,  sizeof(RkHeader),  true,  TCT_RK,   1,    0,    true,  1,  0,   false},
+    {TFF_RKM, "RKM",                 THL_RK,  sizeof(RkHeader),  true,  TCT_RKM,  0,    0,    false, 1,  0,   false},
+    {TFF_RKU, "RKU",                 THL_RK,  sizeof(RkHeader),  true,  TCT_RKU,  2,    0,    true,  1,  0,   false},
+    {TFF_RK4, "RK4 (RK compatible)", THL_RK,  sizeof(RkHeader),  true,  TCT_RK,   16,   0,    true,  2,  0,   false},
+    {TFF_RKS, "RKS",                 THL_RK,  sizeof(RksHeader), false, TCT_RK,   0,    0,    false, 1,  0,   false},
+    {TFF_RKO, "RKO",                 THL_RKO, sizeof(RkoHeader), true,  TCT_RKO,  0,    16,   true,  1,  8,   false},
+    {TFF_BRU, "BRU",                 THL_BRU, sizeof(BruHeader), false, TCT_NONE, 0,    0,    false, 0,  8,   false},
+    {TFF_CAS, "CAS",                 THL_CAS, sizeof(CasHeader), false, TCT_NONE, 0,    0,    false, 0,  6,   true},
+    {TFF_LVT, "LVT",                 THL_LVT, sizeof(LvtHeader), false, TCT_NONE, 0,    0,    false, 0,  6,   true}
+};
+
+inline const TapeFormatDesc& tapeFormatDesc(TapeFileFormat format) {return tapeFormatDescs[format];}
+
+inline int tapeFooterNullBytes(const TapeFormatDesc& desc, size_t bodySize)
+{
+    return desc.footerNullBytes + (desc.bodyAlign ? (-desc.headerSize - bodySize) & (desc.bodyAlign - 1) : 0);
+}
+
+// exact size of the tape file
+inline size_t tapeFileSize(TapeFileFormat format, size_t bodySize)
+{
+    const TapeFormatDesc& desc = tapeFormatDesc(format);
+    return desc.headerSize + bodySize + tapeFooterNullBytes(desc, bodySize) + (desc.footerSyncByte ? 1 : 0) + desc.checksumCopies * 2;
+}
+
+
+bool parseFormat(const std::string& value, TapeFileFormat& format);
+int intFileNameLength(TapeFileFormat format);
+void makeIntName(const char* baseName, int len, uint8_t* intName);
+void makeIntName(const std::string& baseName, int len, uint8_t* intName);
+
+
+// Header and footer of a tape file, the body is not copied
+struct TapeImage {
+    FileHeader header;
+    uint8_t footer[sizeof(FileFooter)];
+    int headerSize;
+    int footerSize;
+
+    const uint8_t* headerData() const {return reinterpret_cast<const uint8_t*>(&header);}
+    const uint8_t* footerData() const {return footer;}
+};
+
+void buildTapeImage(TapeFileFormat format, size_t bodySize, const BlockChecksums& bodyCs, uint16_t loadAddr, uint16_t startAddr,
+                    const uint8_t* intFileName, TapeImage& image);
+
+
+// One of the tape files of a multi-program tape
+struct TapeProgram {
+    TapeImage image;
+    const uint8_t* body;
+    size_t bodySize;
+};
+
+// Tape image formats which may hold several programs in one file (the other ones only as WAV)
+inline bool isContainerFormat(TapeFileFormat format) {return format == TFF_CAS || format == TFF_RKO;}
+
+// CAS blocks start at 8-byte boundaries of the file
+inline int containerAlign(TapeFileFormat format) {return format == TFF_CAS ? 8 : 1;}
+
+
+// Decoding
+
+// Upper bound of the size of a tape file: 64K body plus the sizes of the FileHeader and FileFooter
+// unions, i. e. of the largest header (RKO) and footer
+constexpr size_t maxTapeFileSize = 0x10000 + sizeof(FileHeader) + sizeof(FileFooter);
+
+// Upper bound of the size of a CAS or RKO container, i. e. of 256 programs of the maximum size
+constexpr size_t maxTapeContainerSize = 256 * maxTapeFileSize;
+
+enum TapeDecodeResult {
+    TDR_OK,
+    TDR_BAD_FORMAT,     // header or footer don't match the format
+    TDR_TRUNCATED,      // the file is shorter than stated in the header
+    TDR_BAD_CHECKSUM    // everything is decoded but the checksum doesn't match
+};
+
+
+struct TapeFileInfo {
+    TapeFileFormat format;
+    const uint8_t* body;    // points into the tape file data
+    size_t bodySize;
+    uint16_t loadAddr;
+    uint16_t runAddr;       // load address if the format has no run address
+    bool hasRunAddr;
+    uint8_t intFileName[8];
+    int intFileNameLen;
+    bool hasCs;
+    uint16_t storedCs;
+    uint16_t calcCs;
+    size_t size;            // size of the program in the tape file from the header to the end of the footer
+};
+
+TapeDecodeResult decodeTape(const uint8_t* data, size_t size, TapeFileFormat format, TapeFileInfo& info);
+
+// Decodes the programs of a CAS or RKO container one after another, of other formats only the first program.
+// Decoding stops at the first invalid or truncated program, the ones with checksum errors are skipped.
+// Returns the result of the first program which isn't TDR_OK, its index is stored in errorProgram.
+TapeDecodeResult decodeTapeContainer(const uint8_t* data, size_t size, TapeFileFormat format, std::vector<TapeFileInfo>& programs,
+                                     size_t& errorProgram);
+
+// Detects the format by signatures, sizes and checksums. RKP and RK4 files are reported as TFF_RK.
+bool detectTapeFormat(const uint8_t* data, size_t size, TapeFileFormat& format);
+
+#endif // TAPEFORMAT_H
@@ -0,0 +1,231 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "verify.h"
+#include "fileio.h"
+#include "tapeformat.h"
+
+using namespace std;
+
+
+struct VerifyJob {
+    string fileName;
+    TapeFileFormat format;
+    bool readOk;
+    size_t size;
+    TapeDecodeResult res;
+    TapeFileInfo info;              // the first damaged program
+    size_t nPrograms;
+    size_t errorProgram;
+    bool detected;                  // the file is valid in another format
+    TapeFileFormat detectedFormat;
+};
+
+
+static bool formatFromExtension(const string& fileName, TapeFileFormat& format)
+{
+    size_t dotPos = fileName.find_last_of('.');
+    if (dotPos == string::npos)
+        return false;
+
+    string ext = fileName.substr(dotPos + 1);
+    for (auto& ch: ext)
+        ch = tolower(ch);
+    return parseFormat(ext, format);
+}
+
+
+// Collects the tape files of the directory tree, symbolic links are not followed
+static void scanDir(const string& dirName, vector<VerifyJob>& jobs, vector<string>& badDirs)
+{
+    DIR* dir = opendir(resolvePath(dirName).c_str());
+    if (!dir) {
+        badDirs.push_back(dirName);
+        return;
+    }
+
+    string prefix = dirName;
+    if (prefix.back() != '/' && prefix.back() != '\\')
+        prefix += '/';
+
+    vector<string> subDirs;
+    while (dirent* entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+
+        string path = prefix + name;
+        bool isDir = false;
+        bool isFile = false;
+
+#ifdef _DIRENT_HAVE_D_TYPE
+        if (entry->d_type != DT_UNKNOWN) {
+            isDir = entry->d_type == DT_DIR;
+            isFile = entry->d_type == DT_REG;
+        } else
+#endif
+        {
+            struct stat st;
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__)
+            if (lstat(resolvePath(path).c_str(), &st) == 0) {
+#else
+            if (stat(resolvePath(path).c_str(), &st) == 0) {
+#endif
+                isDir = S_ISDIR(st.st_mode);
+                isFile = S_ISREG(st.st_mode);
+            }
+        }
+
+        VerifyJob job;
+        if (isDir)
+            subDirs.push_back(path);
+        else if (isFile && formatFromExtension(name, job.format)) {
+            job.fileName = path;
+            jobs.push_back(job);
+        }
+    }
+    closedir(dir);
+
+    for (const auto& subDir: subDirs)
+        scanDir(subDir, jobs, badDirs);
+}
+
+
+static void verifyFile(VerifyJob& job)
+{
+    job.size = 0;
+    job.detected = false;
+
+    InputFile file;
+    job.readOk = file.open(job.fileName, isContainerFormat(job.format) ? maxTapeContainerSize : maxTapeFileSize);
+    if (!job.readOk)
+        return;
+
+    // every program of a container is checked
+    vector<TapeFileInfo> programs;
+    job.size = file.size();
+    job.res = decodeTapeContainer(file.data(), file.size(), job.format, programs, job.errorProgram);
+    job.nPrograms = programs.size();
+    job.info = programs[job.errorProgram];
+
+    // a wrong extension can only be guessed by the first program
+    if (job.res != TDR_OK && job.errorProgram == 0)
+        job.detected = detectTapeFormat(file.data(), file.size(), job.detectedFormat);
+
+    job.info.body = nullptr; // points into the file data
+}
+
+
+int verifyTapeArchive(const string& dirName, unsigned nThreads, ostream& msg, ostream& err)
+{
+    auto startTime = chrono::steady_clock::now();
+
+    vector<VerifyJob> jobs;
+    vector<string> badDirs;
+    scanDir(dirName, jobs, badDirs);
+
+    if (badDirs.size() == 1 && badDirs[0] == dirName) {
+        err << "Can't read directory " << dirName << endl;
+        return 1;
+    }
+
+    for (const auto& badDir: badDirs)
+        err << badDir << ": can't read directory" << endl;
+
+    sort(jobs.begin(), jobs.end(), [](const VerifyJob& a, const VerifyJob& b) {return a.fileName < b.fileName;});
+
+    if (!nThreads)
+        nThreads = thread::hardware_concurrency();
+    if (!nThreads)
+        nThreads = 1;
+    if (nThreads > jobs.size() && !jobs.empty())
+        nThreads = jobs.size();
+
+    // the workers see the same files as this thread (server mode)
+    const FileContext* fileContext = currentFileContext();
+
+    atomic<size_t> nextJob(0);
+    auto worker = [&jobs, &nextJob, fileContext]() {
+        setFileContext(fileContext);
+        size_t idx;
+        while ((idx = nextJob++) < jobs.size())
+            verifyFile(jobs[idx]);
+    };
+
+    vector<thread> workers;
+    for (unsigned i = 0; i < nThreads; i++)
+        workers.emplace_back(worker);
+    for (auto& w: workers)
+        w.join();
+
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - startTime).count();
+
+    unsigned nReadErrors = 0, nInvalid = 0, nTruncated = 0, nCsErrors = 0;
+    size_t totalSize = 0;
+
+    for (const auto& job: jobs) {
+        totalSize += job.size;
+
+        if (job.readOk && job.res == TDR_OK)
+            continue;
+
+        err << job.fileName << ": ";
+        if (job.readOk && job.nPrograms > 1)
+            err << "program " << job.errorProgram + 1 << ": ";
+        if (!job.readOk) {
+            err << "read error or file too large";
+            ++nReadErrors;
+        } else if (job.res == TDR_BAD_FORMAT) {
+            err << "not a valid " << tapeFormatDesc(job.format).name << " file";
+            ++nInvalid;
+        } else if (job.res == TDR_TRUNCATED) {
+            err << "truncated";
+            ++nTruncated;
+        } else {
+            err << "checksum error: " << setfill('0') << setw(4) << uppercase << hex << job.info.storedCs <<
+                   ", calculated " << setw(4) << job.info.calcCs << dec;
+            ++nCsErrors;
+        }
+        if (job.detected)
+            err << " (valid " << tapeFormatDesc(job.detectedFormat).name << " file, wrong extension?)";
+        err << endl;
+    }
+
+    unsigned nErrors = nReadErrors + nInvalid + nTruncated + nCsErrors;
+
+    msg << endl << jobs.size() << " file(s), " << totalSize / 1024 << " KB checked in " << fixed << setprecision(2) << secs << " s (" <<
+           setprecision(1) << (secs > 0 ? totalSize / secs / 1e6 : 0) << " MB/s, " << setprecision(0) << (secs > 0 ? jobs.size() / secs : 0) <<
+           " files/s, " << nThreads << " thread(s))" << endl;
+    msg << nErrors << " damaged file(s): " << nCsErrors << " checksum error(s), " << nTruncated << " truncated, " <<
+           nInvalid << " invalid, " << nReadErrors << " read error(s)" << endl;
+
+    return nErrors || !badDirs.empty() ? 1 : 0;
+}
@@ -0,0 +1,35 @@
+/*
+ *  bin2tape v. 1.0
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2021-2023
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// https://github.com/vpyk/EmuUtils
+
+
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <string>
+#include <ostream>
+
+
+// Checks every tape file (recognized by the extension) in the directory tree: the file is decoded
+// in the format given by the extension and its checksum is recalculated. The files are checked
+// by nThreads worker threads (0 = number of CPU cores). Damaged files are reported to err,
+// the summary to msg. Returns the exit code, 0 if all files are valid.
+int verifyTapeArchive(const std::string& dirName, unsigned nThreads, std::ostream& msg, std::ostream& err);
+
+#endif // VERIFY_H
@@ -26,6 +26,7 @@
 #include <string.h>
 
 #include "rkimage/rkvolume.h"
+#include "../bin2tape/checksum.h"
 
 
 #define VERSION "1.02"
@@ -81,29 +82,6 @@ bool strcmpi(const std::string& a, const char* b)
 }
 
 
-uint16_t addToRkCs(uint16_t baseCs, const uint8_t* data, int len, bool lastChunk = false)
-{
-    if (lastChunk)
-        --len;
-
-    for (int i = 0; i < len; i++) {
-        baseCs += data[i];
-        baseCs += (data[i] << 8);
-    }
-
-    if (lastChunk)
-        baseCs = (baseCs & 0xff00) | ((baseCs + data[len]) & 0xff);
-
-    return baseCs;
-}
-
-
-uint16_t calcRkCs(vector<uint8_t>& data)
-{
-    return addToRkCs(0, data.data(), data.size(), true);
-}
-
-
 bool convertToRk(vector<uint8_t> body, uint16_t loadAddr, const string& outputFile)
 {
     int endAddr = loadAddr + body.size() - 1;
@@ -123,7 +101,7 @@ bool convertToRk(vector<uint8_t> body, uint16_t loadAddr, const string& outputFi
     header.endAddrHi = endAddr >> 8;
     header.endAddrLo = endAddr & 0xFF;
 
-    uint16_t cs = calcRkCs(body);
+    uint16_t cs = calcRkCs(body.data(), body.size());
 
     footerSize = sizeof(RkFooter);
     footer.nullByte1 = 0;
@@ -180,7 +158,9 @@ void usage(const string& moduleName, bool showtitle = true)
                     "    t   set file aTtributes" << endl <<
                     "        options:" << endl <<
                     "            -r      - set \"Read only\" attribute" << endl <<
-                    "            -h      - set \"Hidden\" attribute" << endl <<
+                    "            -h      - set \"Hidden\" attribute" << endl << endl <<
+                    "    Options for all commands:" << endl << endl <<
+                    "            -i      - use and update the sector Index file <image_file>.rdx" << endl <<
                     endl;
 }
 
@@ -207,44 +187,44 @@ string makeRkDosFileName(const string& rkFileName)
 }
 
 
-void listFiles(const string& imageFileName, int briefMode)
+void listFiles(const string& imageFileName, int briefMode, bool useIndex)
 {
-    RkVolume vol(imageFileName, IFM_READ_ONLY);
+    RkVolume vol(imageFileName, IFM_READ_ONLY, useIndex);
 
-    auto fileList = vol.getFileList();
+    auto fileList = vol.getFileList(briefMode == 0);
     bool briefListing = (briefMode == 1)? true : false;
     bool b2riefListing = (briefMode == 2)? true : false;
 
     if (briefListing) {
         int i = 0;
-        for (const auto& fi: *fileList) {
-            cout << left << setw(14) << setfill(' ') << fi.fileName << "\t";
+        for (const RkFileInfo* fi: fileList) {
+            cout << left << setw(14) << setfill(' ') << fi->fileName << "\t";
             if (++i % 5 == 0)
                 cout << endl;
         }
         cout << endl;
     } else if (b2riefListing) {
-        for (const auto& fi: *fileList) {
-            cout << fi.fileName << endl;
+        for (const RkFileInfo* fi: fileList) {
+            cout << fi->fileName << endl;
         }
     } else {
         cout << "Name          " << "\t" << "Addr" << "\t" << "Blocks" << "\t" << "  Bytes" << "\t" << "  Attr" << endl;
         cout << "----          " << "\t" << "----" << "\t" << "------" << "\t" << "  -----" << "\t" << "  ----" << endl;
 
-        for (const auto& fi: *fileList) {
-            string attr = fi.attr & 0x80 ? "R" : "";
-            if (fi.attr & 0x40)
+        for (const RkFileInfo* fi: fileList) {
+            string attr = fi->attr & 0x80 ? "R" : "";
+            if (fi->attr & 0x40)
                 attr += "H";
-            cout << left << setw(14) << setfill(' ') << fi.fileName << "\t"
-                 << right << setw(4) << setfill('0') << hex << fi.addr << "\t"
-                 << setw(6) << setfill(' ') << dec << fi.sCount << "\t"
-                 << setw(7) << setfill(' ') << dec << fi.fileSize << "\t"
+            cout << left << setw(14) << setfill(' ') << fi->fileName << "\t"
+                 << right << setw(4) << setfill('0') << hex << fi->addr << "\t"
+                 << setw(6) << setfill(' ') << dec << fi->sCount << "\t"
+                 << setw(7) << setfill(' ') << dec << fi->fileSize << "\t"
                  << setw(6) << attr << endl;
         }
     }
 
     if (!b2riefListing) {
-        cout << endl << fileList->size() << " file(s) total" << endl;
+        cout << endl << fileList.size() << " file(s) total" << endl;
         int freeBlocks = vol.getFreeBlocks();
         int freeDirEntries = vol.getFreeDirEntries();
         cout << endl << freeBlocks << " block(s) (" << freeBlocks * 512 << " bytes) free" << endl;
@@ -253,24 +233,27 @@ void listFiles(const string& imageFileName, int briefMode)
 }
 
 
-void deleteFile(const string& imageFileName, const string& rkFileName)
+// the write commands return the number of bytes written to the image
+
+size_t deleteFile(const string& imageFileName, const string& rkFileName, bool useIndex)
 {
-    RkVolume vol(imageFileName, IFM_READ_WRITE);
+    RkVolume vol(imageFileName, IFM_READ_WRITE, useIndex);
     vol.deleteFile(rkFileName);
-    vol.saveImage();
+    return vol.saveImage();
 }
 
 
-void setAttributes(const string& imageFileName, const string& rkFileName, bool readOnly, bool hidden)
+size_t setAttributes(const string& imageFileName, const string& rkFileName, bool readOnly, bool hidden, bool useIndex)
 {
-    RkVolume vol(imageFileName, IFM_READ_WRITE);
+    RkVolume vol(imageFileName, IFM_READ_WRITE, useIndex);
     uint8_t attr = (readOnly ? 0x80 : 0) | (hidden ? 0x40 : 0);
     vol.setAttributes(rkFileName, attr);
-    vol.saveImage();
+    return vol.saveImage();
 }
 
 
-bool addFile(const string& imageFileName, const string& rkFileName, uint16_t addr, bool readOnly, bool hidden, bool allowOverwrite)
+bool addFile(const string& imageFileName, const string& rkFileName, uint16_t addr, bool readOnly, bool hidden, bool allowOverwrite, bool useIndex,
+             size_t& written)
 {
     ifstream rkFile(rkFileName, ios::binary);
     if (!rkFile.is_open()) {
@@ -292,12 +275,12 @@ bool addFile(const string& imageFileName, const string& rkFileName, uint16_t add
 
     rkFile.close();
 
-    RkVolume vol(imageFileName, IFM_READ_WRITE);
+    RkVolume vol(imageFileName, IFM_READ_WRITE, useIndex);
 
     uint8_t attr = (readOnly ? 0x80 : 0) | (hidden ? 0x40 : 0);
 
     vol.writeFile(rkFileName, buf, size, addr, attr, allowOverwrite);
-    vol.saveImage();
+    written = vol.saveImage();
 
     return true;
 }
@@ -333,9 +316,9 @@ vector<uint8_t> decodeCP(const vector<uint8_t>& src, int codePage)
     return dst;
 }
 
-bool extractFile(const string& imageFileName, const string& rkFileName, const string& targetFileName, bool extractToTape, int codePage)
+bool extractFile(const string& imageFileName, const string& rkFileName, const string& targetFileName, bool extractToTape, int codePage, bool useIndex)
 {
-    RkVolume vol(imageFileName, IFM_READ_ONLY);
+    RkVolume vol(imageFileName, IFM_READ_ONLY, useIndex);
 
     int size = 0;
     uint16_t start = 0;
@@ -373,11 +356,11 @@ bool extractFile(const string& imageFileName, const string& rkFileName, const st
 }
 
 
-void formatImage(const string& imageFileName, int directorySize)
+size_t formatImage(const string& imageFileName, int directorySize, bool useIndex)
 {
-    RkVolume vol(imageFileName, IFM_WRITE_CREATE);
+    RkVolume vol(imageFileName, IFM_WRITE_CREATE, useIndex);
     vol.format(directorySize);
-    vol.saveImage();
+    return vol.saveImage();
 }
 
 
@@ -398,6 +381,7 @@ int main(int argc, const char** argv)
     bool hidden = false;
     bool noConfirmation = false;
     bool extractToTape = false;
+    bool useIndex = false;
     uint16_t startingAddr = 0;
     int directorySize = 4;
     int codePage = -1;
@@ -482,6 +466,8 @@ int main(int argc, const char** argv)
                 return 1;
             }
             hidden = true;
+        } else if (option == "-i") {
+            useIndex = true;
         } else if (option == "-t") {
             if (i > argc || command != "x") {
                 usage(moduleName);
@@ -550,7 +536,7 @@ int main(int argc, const char** argv)
             if (!b2riefListing) {
                 cout << "Directory content for image " << imageFileName << ":" << endl << endl;
             }
-            listFiles(imageFileName, briefListing? 1 : b2riefListing? 2 : 0);
+            listFiles(imageFileName, briefListing? 1 : b2riefListing? 2 : 0, useIndex);
             return 0;
         } else if (command == "f") {
             if (!targetFileName.empty()) {
@@ -567,8 +553,8 @@ int main(int argc, const char** argv)
             }
 
             cout << "Formatting image " << imageFileName << ", " << directorySize << " sector(s) directory ... ";
-            formatImage(imageFileName, directorySize);
-            cout << "done." << endl;
+            size_t written = formatImage(imageFileName, directorySize, useIndex);
+            cout << "done, " << written << " bytes written." << endl;
             return 0;
         }
 
@@ -578,11 +564,13 @@ int main(int argc, const char** argv)
             return 1;
         }
 
+        size_t written = 0;
+
         if (command == "x") {
             if (targetFileName.empty())
                 targetFileName = rkFileName;
             cout << "Extracting file " << rkFileName << " from image " << imageFileName << " to " << targetFileName << " ... ";
-            if (!extractFile(imageFileName, rkFileName, targetFileName, extractToTape, codePage))
+            if (!extractFile(imageFileName, rkFileName, targetFileName, extractToTape, codePage, useIndex))
                 return 1;
         } else if (command == "a") {
             if (!targetFileName.empty()) {
@@ -595,7 +583,7 @@ int main(int argc, const char** argv)
             if (rkFileNameWoPath != newRkFileName)
                 cout << "New rk file name: " << newRkFileName << endl;
             cout << "Adding file " << rkFileNameWoPath << " to image " << imageFileName << " ... ";
-            addFile(imageFileName, newRkFileName, startingAddr, readOnly, hidden, allowOverwrite);
+            addFile(imageFileName, newRkFileName, startingAddr, readOnly, hidden, allowOverwrite, useIndex, written);
         } else if (command == "d") {
             if (!targetFileName.empty()) {
                 cout << "Extra file name specified!" << endl << endl;
@@ -603,7 +591,7 @@ int main(int argc, const char** argv)
                 return 1;
             }
             cout << "Deleting file " << rkFileName << " from image " << imageFileName << " ... ";
-            deleteFile(imageFileName, rkFileName);
+            written = deleteFile(imageFileName, rkFileName, useIndex);
         } else if (command == "t") {
             if (!targetFileName.empty()) {
                 cout << "Extra file name specified!" << endl << endl;
@@ -611,10 +599,13 @@ int main(int argc, const char** argv)
                 return 1;
             }
             cout << "Setting file attributes " << rkFileName << " from image " << imageFileName << " ... ";
-            setAttributes(imageFileName, rkFileName, readOnly, hidden);
+            written = setAttributes(imageFileName, rkFileName, readOnly, hidden, useIndex);
         }
 
-        cout << "done." << endl;
+        if (command == "x")
+            cout << "done." << endl;
+        else
+            cout << "done, " << written << " bytes written." << endl;
 
         return 0;
     }
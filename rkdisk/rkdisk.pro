@@ -6,12 +6,16 @@ CONFIG -= qt
 SOURCES += \
     rkdisk.cpp \
     rkimage/imagefile.cpp \
+    rkimage/rkindex.cpp \
     rkimage/rkvolume.cpp \
-    rkimage/volume.cpp
+    rkimage/volume.cpp \
+    ../bin2tape/checksum.cpp
 
 HEADERS += \
     rkimage/imagefile.h \
+    rkimage/rkindex.h \
     rkimage/rkvolume.h \
-    rkimage/volume.h
+    rkimage/volume.h \
+    ../bin2tape/checksum.h
 
 QMAKE_LFLAGS += -static -static-libgcc
@@ -17,22 +17,167 @@
 
 #include <string>
 #include <fstream>
+#include <algorithm>
 
 #include <cstring>
 
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__)
+#define IMAGEFILE_POSIX
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include <sys/stat.h>
+
 #include "imagefile.h"
 
 using namespace std;
 
 
+#ifdef IMAGEFILE_POSIX
+
+ImageFile::ImageFile(const string& fileName, ImageFileMode mode, size_t imageSize)
+{
+    m_mode = mode;
+    m_size = imageSize;
+
+    int flags;
+    switch (mode) {
+    case IFM_READ_ONLY:
+        flags = O_RDONLY;
+        break;
+    case IFM_READ_WRITE:
+        flags = O_RDWR;
+        break;
+    default: // IFM_WRITE_CREATE
+        flags = O_RDWR | O_CREAT | O_TRUNC;
+        break;
+    }
+
+    m_fd = ::open(fileName.c_str(), flags, 0666);
+    if (m_fd < 0)
+        throw IFE_OPEN_ERROR;
+
+    size_t fileSize = 0;
+    if (mode != IFM_WRITE_CREATE) {
+        // open existing file
+        struct stat st;
+        if (fstat(m_fd, &st)) {
+            ::close(m_fd);
+            throw IFE_READ_ERROR;
+        }
+        fileSize = st.st_size;
+    } else if (ftruncate(m_fd, m_size) == 0)
+        // new file is filled with zeros
+        fileSize = m_size;
+
+    if (m_size && fileSize >= m_size) {
+        // the mapping is private, so nothing gets to the file until updateAll() writes the changed ranges
+        void* map = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, m_fd, 0);
+        if (map != MAP_FAILED) {
+            m_map = map;
+            m_data = static_cast<uint8_t*>(map);
+            return;
+        }
+    }
+
+    // the file is shorter than the image or mmap failed
+    readFile(fileSize);
+
+    // a short file is extended to the image size on update
+    if (mode != IFM_READ_ONLY && fileSize < m_size)
+        markDirty(0, m_size);
+}
+
+
+void ImageFile::readFile(size_t fileSize)
+{
+    m_buf.assign(m_size, 0);
+    m_data = m_buf.data();
+
+    size_t toRead = m_size < fileSize ? m_size : fileSize;
+    size_t pos = 0;
+    while (pos < toRead) {
+        ssize_t res = pread(m_fd, m_data + pos, toRead - pos, pos);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0) {
+            ::close(m_fd);
+            throw IFE_READ_ERROR;
+        }
+        pos += res;
+    }
+}
+
+
+ImageFile::~ImageFile()
+{
+    if (m_map)
+        munmap(m_map, m_size);
+    if (m_fd >= 0)
+        ::close(m_fd);
+}
+
+
+bool ImageFile::isOpen()
+{
+    return m_fd >= 0;
+}
+
+
+size_t ImageFile::updateAll()
+{
+    if (m_mode == IFM_READ_ONLY)
+        return 0;
+
+    size_t written = 0;
+
+    mergeDirty(1);
+    for (const auto& range: m_dirty) {
+        size_t pos = range.first;
+        while (pos < range.second) {
+            ssize_t res = pwrite(m_fd, m_data + pos, range.second - pos, pos);
+            if (res < 0 && errno == EINTR)
+                continue;
+            if (res <= 0)
+                throw IFE_WRITE_ERROR;
+            pos += res;
+        }
+        written += range.second - range.first;
+    }
+    m_dirty.clear();
+    return written;
+}
+
+
+bool ImageFile::getFileStamp(uint64_t& fileSize, int64_t& modTime)
+{
+    struct stat st;
+    if (fstat(m_fd, &st))
+        return false;
+
+    fileSize = st.st_size;
+#ifdef __APPLE__
+    modTime = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    modTime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+#else
+
 ImageFile::ImageFile(const string& fileName, ImageFileMode mode, size_t imageSize)
 {
     size_t file_size;
 
+    m_fileName = fileName;
     m_mode = mode;
     m_size = imageSize;
-    m_buf = new uint8_t[m_size];
-    memset(m_buf, 0, m_size);
+    m_buf.assign(m_size, 0);
+    m_data = m_buf.data();
 
     ios_base::openmode openMode;
     switch (mode) {
@@ -42,7 +187,7 @@ ImageFile::ImageFile(const string& fileName, ImageFileMode mode, size_t imageSiz
     case IFM_READ_WRITE:
         openMode = ios::binary | ios::in | ios::out;
         break;
-    case IFM_WRITE_CREATE:
+    default: // IFM_WRITE_CREATE
         openMode = ios::binary | ios::out | std::fstream::trunc;
         break;
     }
@@ -56,19 +201,14 @@ ImageFile::ImageFile(const string& fileName, ImageFileMode mode, size_t imageSiz
         m_file.seekg(0, ios::end);
         file_size = m_file.tellg();
         m_file.seekg(0, ios::beg);
-        //m_buf = new uint8_t[m_size];
-        m_file.read((char*)(m_buf), (m_size < file_size)? m_size : file_size);
-        if (m_file.rdstate()) {
+        m_file.read((char*)(m_data), (m_size < file_size)? m_size : file_size);
+        if (m_file.rdstate())
             throw IFE_READ_ERROR;
-            m_file.close();
-        }
     }
-    //else {
-    //    // create new file
-    //    m_buf = new uint8_t[imageSize];
-    //    m_size = imageSize;
-    //    memset(m_buf, 0, m_size);
-    //}
+
+    // a new or short file is extended to the image size on update
+    if (mode == IFM_WRITE_CREATE || (mode == IFM_READ_WRITE && file_size < m_size))
+        markDirty(0, m_size);
 }
 
 
@@ -85,30 +225,92 @@ bool ImageFile::isOpen()
 }
 
 
-size_t ImageFile::getSize()
+size_t ImageFile::updateAll()
 {
-    return m_size;
+    if (m_mode == IFM_READ_ONLY)
+        return 0;
+
+    size_t written = 0;
+
+    mergeDirty(1);
+    for (const auto& range: m_dirty) {
+        m_file.seekp(range.first, ios::beg);
+        m_file.write((char*)(m_data + range.first), range.second - range.first);
+        if (m_file.rdstate())
+            throw IFE_WRITE_ERROR;
+        written += range.second - range.first;
+    }
+    m_dirty.clear();
+    return written;
 }
 
 
-uint8_t* ImageFile::getData()
+bool ImageFile::getFileStamp(uint64_t& fileSize, int64_t& modTime)
 {
-    return m_buf;
+    m_file.flush();
+
+    struct stat st;
+    if (stat(m_fileName.c_str(), &st))
+        return false;
+
+    fileSize = st.st_size;
+    modTime = int64_t(st.st_mtime) * 1000000000;
+    return true;
 }
 
+#endif // IMAGEFILE_POSIX
 
-uint8_t& ImageFile::operator[](ptrdiff_t idx)
+
+void ImageFile::markDirty(size_t offset, size_t size)
 {
-    return m_buf[idx];
+    if (offset >= m_size || !size)
+        return;
+
+    size_t end = size < m_size - offset ? offset + size : m_size;
+
+    // consecutive changes of the same area are joined at once
+    if (!m_dirty.empty() && offset <= m_dirty.back().second && end >= m_dirty.back().first) {
+        m_dirty.back().first = min(m_dirty.back().first, offset);
+        m_dirty.back().second = max(m_dirty.back().second, end);
+    } else
+        m_dirty.push_back({offset, end});
 }
 
-void ImageFile::updateAll()
+
+// sorts the ranges, aligns them and joins the overlapping and adjacent ones
+void ImageFile::mergeDirty(size_t align)
 {
-    if (m_mode == IFM_READ_ONLY)
-        return;
+    for (auto& range: m_dirty) {
+        range.first -= range.first % align;
+        range.second = min((range.second + align - 1) / align * align, m_size);
+    }
 
-    m_file.seekg(0, ios::beg);
-    m_file.write((char*)(m_buf), m_size);
-    if (m_file.rdstate())
-        throw IFE_WRITE_ERROR;
+    sort(m_dirty.begin(), m_dirty.end());
+
+    size_t n = 0;
+    for (const auto& range: m_dirty) {
+        if (n && range.first <= m_dirty[n - 1].second)
+            m_dirty[n - 1].second = max(m_dirty[n - 1].second, range.second);
+        else
+            m_dirty[n++] = range;
+    }
+    m_dirty.resize(n);
+}
+
+
+size_t ImageFile::getSize()
+{
+    return m_size;
+}
+
+
+uint8_t* ImageFile::getData()
+{
+    return m_data;
+}
+
+
+uint8_t& ImageFile::operator[](ptrdiff_t idx)
+{
+    return m_data[idx];
 }
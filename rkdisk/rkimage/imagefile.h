@@ -18,8 +18,15 @@
 #ifndef IMAGEFILE_H
 #define IMAGEFILE_H
 
+#include <cstdint>
+#include <cstddef>
+
 #include <string>
+#include <vector>
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
 #include <fstream>
+#endif
 
 enum ImageFileMode {
     IFM_READ_ONLY,
@@ -33,23 +40,46 @@ enum ImageFileException {
     IFE_WRITE_ERROR
 };
 
+// Disk image contents. The image file is memory mapped where possible. The mapping is private,
+// so a failed operation which is not saved leaves the file intact. Files shorter than the image
+// size (and all files on Windows) are read into a buffer padded with zeros.
+// The changed ranges are reported with markDirty(), updateAll() writes only them.
 class ImageFile
 {
 public:
     ImageFile(const std::string& fileName, ImageFileMode mode, size_t imageSize);
     ~ImageFile();
 
+    ImageFile(const ImageFile&) = delete;
+    ImageFile& operator=(const ImageFile&) = delete;
+
     bool isOpen();
     size_t getSize();
     uint8_t* getData();
-    void updateAll();
+    void markDirty(size_t offset, size_t size);
+    size_t updateAll(); // returns the number of bytes written
+
+    // size and modification time (ns) of the file
+    bool getFileStamp(uint64_t& fileSize, int64_t& modTime);
     uint8_t& operator[](std::ptrdiff_t idx);
 
 private:
-    std::fstream m_file;
     size_t m_size = 0;
-    uint8_t* m_buf = nullptr;
+    uint8_t* m_data = nullptr;
     ImageFileMode m_mode;
+    std::vector<uint8_t> m_buf;     // used if the file is not mapped
+    std::vector<std::pair<size_t, size_t>> m_dirty; // changed ranges: begin, end
+
+    void mergeDirty(size_t align);
+#if !defined(WIN32) && !defined(_WIN32) && !defined(__WIN32__)
+    int m_fd = -1;
+    void* m_map = nullptr;
+
+    void readFile(size_t fileSize);
+#else
+    std::fstream m_file;
+    std::string m_fileName;
+#endif
 };
 
 #endif // IMAGEFILE_H
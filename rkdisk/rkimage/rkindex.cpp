@@ -0,0 +1,223 @@
+/*
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2024
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include <string>
+#include <fstream>
+
+#include "rkindex.h"
+
+using namespace std;
+
+
+static const char c_indexMagic[4] = {'R', 'K', 'I', 'X'};
+static const uint16_t c_indexVersion = 1;
+
+
+uint64_t calcRkHash(const uint8_t* data, size_t len, uint64_t hash)
+{
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+
+// little endian serialization
+
+static void put(vector<uint8_t>& buf, uint64_t value, int size)
+{
+    for (int i = 0; i < size; i++) {
+        buf.push_back(value & 0xFF);
+        value >>= 8;
+    }
+}
+
+
+class IndexReader
+{
+public:
+    IndexReader(const vector<uint8_t>& buf) : m_buf(buf) {}
+
+    bool ok() const {return m_ok;}
+    bool atEnd() const {return m_pos == m_buf.size();}
+
+    uint64_t get(int size)
+    {
+        if (m_buf.size() - m_pos < size_t(size)) {
+            m_ok = false;
+            return 0;
+        }
+        uint64_t value = 0;
+        for (int i = size - 1; i >= 0; i--)
+            value = (value << 8) | m_buf[m_pos + i];
+        m_pos += size;
+        return value;
+    }
+
+    string getString(size_t len)
+    {
+        if (m_buf.size() - m_pos < len) {
+            m_ok = false;
+            return string();
+        }
+        string value(reinterpret_cast<const char*>(m_buf.data() + m_pos), len);
+        m_pos += len;
+        return value;
+    }
+
+private:
+    const vector<uint8_t>& m_buf;
+    size_t m_pos = 0;
+    bool m_ok = true;
+};
+
+
+bool readRkIndex(const string& fileName, RkIndex& index)
+{
+    ifstream file(fileName, ios::binary);
+    if (!file.is_open())
+        return false;
+
+    file.seekg(0, ios::end);
+    streamoff size = file.tellg();
+    file.seekg(0, ios::beg);
+    if (size < 16 || size > 0x100000)
+        return false;
+
+    vector<uint8_t> buf(size);
+    file.read(reinterpret_cast<char*>(buf.data()), size);
+    if (file.rdstate())
+        return false;
+
+    // the trailing hash guards against partially written and damaged files
+    uint64_t storedHash = 0;
+    for (int i = 7; i >= 0; i--)
+        storedHash = (storedHash << 8) | buf[size - 8 + i];
+    buf.resize(size - 8);
+    if (calcRkHash(buf.data(), buf.size()) != storedHash)
+        return false;
+
+    IndexReader reader(buf);
+
+    if (reader.getString(4) != string(c_indexMagic, 4) || reader.get(2) != c_indexVersion)
+        return false;
+    reader.get(2);
+
+    index.imageSize = reader.get(8);
+    index.imageTime = reader.get(8);
+    index.hash = reader.get(8);
+
+    for (int t = 0; t < RK_TRACKCNT; t++)
+        for (int s = 0; s < RK_SECTTRCNT; s++) {
+            index.sectorOffsets[t][s] = reader.get(4);
+            index.sectorLens[t][s] = reader.get(2);
+        }
+
+    index.freeDirEntries = reader.get(2);
+
+    index.dirSectors.resize(reader.get(2));
+    for (auto& dirSector: index.dirSectors)
+        dirSector = reader.get(2);
+
+    index.files.resize(reader.get(2));
+    for (auto& fi: index.files) {
+        string fileName = reader.getString(reader.get(1));
+        if (fileName.size() >= RK_FILENAMELEN)
+            return false;
+        memset(fi.fileName, 0, RK_FILENAMELEN);
+        memcpy(fi.fileName, fileName.data(), fileName.size());
+        fi.dirTrack = reader.get(1);
+        fi.dirSector = reader.get(1);
+        fi.dirOffset = reader.get(2);
+        fi.tList = reader.get(1);
+        fi.sList = reader.get(1);
+        fi.sCount = reader.get(2);
+        fi.attr = reader.get(1);
+        fi.addr = reader.get(2);
+        fi.fileSize = reader.get(4);
+    }
+
+    return reader.ok() && reader.atEnd();
+}
+
+
+bool writeRkIndex(const string& fileName, const RkIndex& index)
+{
+    vector<uint8_t> buf(c_indexMagic, c_indexMagic + 4);
+    put(buf, c_indexVersion, 2);
+    put(buf, 0, 2);
+
+    put(buf, index.imageSize, 8);
+    put(buf, index.imageTime, 8);
+    put(buf, index.hash, 8);
+
+    for (int t = 0; t < RK_TRACKCNT; t++)
+        for (int s = 0; s < RK_SECTTRCNT; s++) {
+            put(buf, index.sectorOffsets[t][s], 4);
+            put(buf, index.sectorLens[t][s], 2);
+        }
+
+    put(buf, index.freeDirEntries, 2);
+
+    put(buf, index.dirSectors.size(), 2);
+    for (auto dirSector: index.dirSectors)
+        put(buf, dirSector, 2);
+
+    put(buf, index.files.size(), 2);
+    for (const auto& fi: index.files) {
+        size_t nameLen = strnlen(fi.fileName, RK_FILENAMELEN);
+        put(buf, nameLen, 1);
+        buf.insert(buf.end(), fi.fileName, fi.fileName + nameLen);
+        put(buf, fi.dirTrack, 1);
+        put(buf, fi.dirSector, 1);
+        put(buf, fi.dirOffset, 2);
+        put(buf, fi.tList, 1);
+        put(buf, fi.sList, 1);
+        put(buf, fi.sCount, 2);
+        put(buf, fi.attr, 1);
+        put(buf, fi.addr, 2);
+        put(buf, fi.fileSize, 4);
+    }
+
+    put(buf, calcRkHash(buf.data(), buf.size()), 8);
+
+    // the index is replaced at once, so the other processes never see a partially written file
+    string tempFileName = fileName + ".tmp";
+    ofstream file(tempFileName, ios::binary | ios::trunc);
+    if (!file.is_open())
+        return false;
+    file.write(reinterpret_cast<const char*>(buf.data()), buf.size());
+    file.close();
+    if (file.fail()) {
+        remove(tempFileName.c_str());
+        return false;
+    }
+
+#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
+    remove(fileName.c_str());
+#endif
+    if (rename(tempFileName.c_str(), fileName.c_str())) {
+        remove(tempFileName.c_str());
+        return false;
+    }
+
+    return true;
+}
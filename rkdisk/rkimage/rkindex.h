@@ -0,0 +1,52 @@
+/*
+ *  (c) Viktor Pykhonin <pyk@mail.ru>, 2024
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RKINDEX_H
+#define RKINDEX_H
+
+#include <cstdint>
+#include <cstddef>
+
+#include <string>
+#include <vector>
+
+#include "rkvolume.h"
+
+
+// Sidecar index of an RK DOS image (<image>.rdx). It holds everything RkVolume finds out
+// when it parses the image: the sector locations, the directory chain and the file list
+// with the file sizes. The index is valid while the size and modification time of the image
+// match and the VTOC and directory sectors have the same hash.
+
+struct RkIndex {
+    uint64_t imageSize = 0;
+    int64_t imageTime = 0;                          // modification time, ns
+    uint64_t hash = 0;                              // hash of the VTOC and directory sectors
+    uint32_t sectorOffsets[RK_TRACKCNT][RK_SECTTRCNT];  // offsets of the sector data in the image
+    uint16_t sectorLens[RK_TRACKCNT][RK_SECTTRCNT];
+    std::vector<uint16_t> dirSectors;               // directory chain, track << 8 | sector
+    int freeDirEntries = 0;
+    std::vector<RkFileInfo> files;                  // sorted by name
+};
+
+bool readRkIndex(const std::string& fileName, RkIndex& index);
+bool writeRkIndex(const std::string& fileName, const RkIndex& index);
+
+// FNV-1a
+uint64_t calcRkHash(const uint8_t* data, size_t len, uint64_t hash = 0xCBF29CE484222325ULL);
+
+#endif // RKINDEX_H
@@ -20,16 +20,21 @@
 #include <cassert>
 
 #include <string>
+#include <vector>
 #include <algorithm>
 
 #include "rkvolume.h"
+#include "rkindex.h"
+#include "../../bin2tape/checksum.h"
 
 using namespace std;
 
 
 //RkVolume::RkVolume(const std::string& fileName, ImageFileMode mode) : Volume(fileName, mode, mode == IFM_WRITE_CREATE ? RK_IMAGESIZE : 0)
-RkVolume::RkVolume(const std::string& fileName, ImageFileMode mode) : Volume(fileName, mode, RK_IMAGESIZE)
+RkVolume::RkVolume(const std::string& fileName, ImageFileMode mode, bool useIndex) : Volume(fileName, mode, RK_IMAGESIZE)
 {
+    if (useIndex)
+        m_indexFileName = fileName + ".rdx";
 }
 
 
@@ -63,114 +68,239 @@ void RkVolume::readDisk()
     if (m_diskRead)
         return;
 
-    readSectors();
+    if (!m_indexFileName.empty() && loadIndex()) {
+        m_diskRead = true;
+        return;
+    }
+
+    // the tracks are read on demand
     readVtoc();
     readDir();
 
     m_diskRead = true;
+
+    if (!m_indexFileName.empty())
+        saveIndex();
 }
 
 
-void RkVolume::readSectors()
+bool RkVolume::loadIndex()
 {
-    for (int t = 0; t < RK_TRACKCNT; t++) {
-        uint8_t* trackData = m_image->getData() + t * RK_BYTESTRK;
-
-        int pos = 0;
-        int nSectorsFound = 0;
-        for (int i = 0; i < RK_SECTTRCNT; i++)
-            m_sectors[t][i].dirty = true;
-
-        while (pos < RK_BYTESTRK && nSectorsFound < RK_SECTTRCNT) {
-            // find syncrobyte
-            while (pos < RK_BYTESTRK && trackData[pos] != 0x06)
-                pos++;
-
-            // find address mark
-            while (pos < RK_BYTESTRK - 3 && trackData[pos] != 0xEA && trackData[pos + 1] != 0xD3)
-                pos++;
-            pos += 2;
-
-            //if (pos >= RK_BYTESTRK - 2)
-            //    throw RkVolumeException {RkVolumeException::RVET_BAD_DISK_FORMAT, t, 11};
-
-            int nTrack = trackData[pos++];
-            int nSect = trackData[pos++];
-            if (nTrack != t)
-                //throw RkVolumeException {RkVolumeException::RVET_BAD_DISK_FORMAT, t, 12};
-                continue;
+    RkIndex index;
+    uint64_t imageSize;
+    int64_t imageTime;
+
+    if (!readRkIndex(m_indexFileName, index) || !m_image->getFileStamp(imageSize, imageTime) ||
+            imageSize != index.imageSize || imageTime != index.imageTime)
+        return false;
 
-            // find synchrobyte
-            while (pos < RK_BYTESTRK && trackData[pos] != 0x06)
-                pos++;
+    for (int t = 0; t < RK_TRACKCNT; t++)
+        for (int s = 0; s < RK_SECTTRCNT; s++) {
+            uint32_t offset = index.sectorOffsets[t][s];
+            // a sector may be written with its full size (see allocateSpecificSector())
+            if (offset < 3 || offset + max<size_t>(index.sectorLens[t][s], RK_DATASECT) + 2 > m_image->getSize())
+                return false;
+        }
 
-            // find data mark
-            while (pos < RK_BYTESTRK - 3 && trackData[pos] != 0xDD && trackData[pos + 1] != 0xF3)
-                pos++;
-            pos += 2;
+    for (auto dirSector: index.dirSectors)
+        if ((dirSector >> 8) >= RK_TRACKCNT || (dirSector & 0xFF) >= RK_SECTTRCNT)
+            return false;
 
-            //if (pos >= RK_BYTESTRK - 519)
-            //    throw RkVolumeException {RkVolumeException::RVET_BAD_DISK_FORMAT, nTrack, nSect};
+    // the directory entries are changed in place, so they must be in the directory chain
+    for (const auto& fi: index.files)
+        if (fi.dirOffset < 7 || fi.dirOffset >= 7 + 24 * 21 || (fi.dirOffset - 7) % 21 ||
+                find(index.dirSectors.begin(), index.dirSectors.end(), (fi.dirTrack << 8) | fi.dirSector) == index.dirSectors.end())
+            return false;
 
-            int sectLen = trackData[pos] + (trackData[pos + 1] << 8);
-            pos += 3;
+    for (int t = 0; t < RK_TRACKCNT; t++)
+        for (int s = 0; s < RK_SECTTRCNT; s++) {
+            m_sectors[t][s].ptr = m_image->getData() + index.sectorOffsets[t][s];
+            m_sectors[t][s].len = index.sectorLens[t][s];
+        }
 
-            m_sectors[nTrack][nSect].ptr = trackData + pos;
-            m_sectors[nTrack][nSect].len = sectLen;
-            m_sectors[nTrack][nSect].dirty = false;
+    // the image might have been changed within the time stamp resolution
+    if (calcIndexHash(index.dirSectors) != index.hash)
+        return false;
 
-            nSectorsFound++;
+    for (int t = 0; t < RK_TRACKCNT; t++)
+        m_trackRead[t] = true;
+
+    readVtoc();
+
+    m_dirSectors = index.dirSectors;
+    readDirFreeMap();
+
+    // the sizes are recalculated from the sector chains, readFile() relies on them
+    m_files = index.files;
+    for (auto& fi: m_files)
+        fi.fileSize = -1;
+    buildFileIndex();
+    m_freeDirEntries = index.freeDirEntries;
+
+    return true;
+}
+
+
+// the index is just a cache, so it's not written for damaged images and the errors are ignored
+void RkVolume::saveIndex()
+{
+    RkIndex index;
+
+    if (!m_image->getFileStamp(index.imageSize, index.imageTime))
+        return;
+
+    try {
+        for (auto& fi: m_files)
+            calcSize(fi);
+    }
+    catch (RkVolumeException&) {
+        return;
+    }
 
-            //pos += 530;
-            pos += (sectLen + 18);
+    for (int t = 0; t < RK_TRACKCNT; t++)
+        for (int s = 0; s < RK_SECTTRCNT; s++) {
+            if (!m_trackRead[t])
+                readTrack(t);
+            if (!m_sectors[t][s].ptr)
+                return;
+            index.sectorOffsets[t][s] = m_sectors[t][s].ptr - m_image->getData();
+            index.sectorLens[t][s] = m_sectors[t][s].len;
         }
-        bool allSect = true;
-        for (int i = 0; i < RK_SECTTRCNT; i++)
-            allSect = allSect || m_sectors[t][i].dirty;
-        if (!allSect)
-            throw RkVolumeException {RkVolumeException::RVET_BAD_DISK_FORMAT, 0, 13}; // there are missings sectors on the track
+
+    index.dirSectors = m_dirSectors;
+    index.hash = calcIndexHash(index.dirSectors);
+    index.freeDirEntries = m_freeDirEntries;
+    for (auto n: m_sortedFiles)
+        index.files.push_back(m_files[n]);
+
+    writeRkIndex(m_indexFileName, index);
+}
+
+
+uint64_t RkVolume::calcIndexHash(const vector<uint16_t>& dirSectors)
+{
+    uint64_t hash = calcRkHash(m_sectors[32][0].ptr, m_sectors[32][0].len);
+    for (auto dirSector: dirSectors) {
+        const RkSector& sector = m_sectors[dirSector >> 8][dirSector & 0xFF];
+        hash = calcRkHash(sector.ptr, sector.len, hash);
     }
+    return hash;
 }
 
 
-void RkVolume::readVtoc()
+RkSector& RkVolume::getSector(int track, int sector)
+{
+    if (track >= RK_TRACKCNT || sector >= RK_SECTTRCNT)
+        throw RkVolumeException {RkVolumeException::RVET_SECTOR_NOT_FOUND, track, sector};
+
+    if (!m_trackRead[track])
+        readTrack(track);
+
+    RkSector& sect = m_sectors[track][sector];
+    if (!sect.ptr)
+        throw RkVolumeException {RkVolumeException::RVET_SECTOR_NOT_FOUND, track, sector};
+
+    return sect;
+}
+
+
+// Finds the sectors of the track. The sectors which are not found are left with null pointers
+// and reported as not found on access.
+void RkVolume::readTrack(int t)
 {
-    int allocated = 0;
+    uint8_t* trackData = m_image->getData() + t * RK_BYTESTRK;
+
+    int pos = 0;
+    int nSectorsFound = 0;
+    for (int i = 0; i < RK_SECTTRCNT; i++)
+        m_sectors[t][i].ptr = nullptr;
+
+    while (pos < RK_BYTESTRK && nSectorsFound < RK_SECTTRCNT) {
+        // find syncrobyte
+        while (pos < RK_BYTESTRK && trackData[pos] != 0x06)
+            pos++;
+
+        // find address mark
+        while (pos < RK_BYTESTRK - 3 && trackData[pos] != 0xEA && trackData[pos + 1] != 0xD3)
+            pos++;
+        pos += 2;
+
+        //if (pos >= RK_BYTESTRK - 2)
+        //    throw RkVolumeException {RkVolumeException::RVET_BAD_DISK_FORMAT, t, 11};
+
+        int nTrack = trackData[pos++];
+        int nSect = trackData[pos++];
+        if (nTrack != t || nSect >= RK_SECTTRCNT)
+            //throw RkVolumeException {RkVolumeException::RVET_BAD_DISK_FORMAT, t, 12};
+            continue;
 
-    uint8_t* vtocPtr = m_sectors[32][0].ptr;
+        // find synchrobyte
+        while (pos < RK_BYTESTRK && trackData[pos] != 0x06)
+            pos++;
+
+        // find data mark
+        while (pos < RK_BYTESTRK - 3 && trackData[pos] != 0xDD && trackData[pos + 1] != 0xF3)
+            pos++;
+        pos += 2;
+
+        //if (pos >= RK_BYTESTRK - 519)
+        //    throw RkVolumeException {RkVolumeException::RVET_BAD_DISK_FORMAT, nTrack, nSect};
+
+        int sectLen = trackData[pos] + (trackData[pos + 1] << 8);
+        pos += 3;
+
+        m_sectors[nTrack][nSect].ptr = trackData + pos;
+        m_sectors[nTrack][nSect].len = sectLen;
+
+        nSectorsFound++;
+
+        //pos += 530;
+        pos += (sectLen + 18);
+    }
+
+    m_trackRead[t] = true;
+}
+
+
+void RkVolume::readVtoc()
+{
+    uint8_t* vtocPtr = getSector(32, 0).ptr;
     if ((vtocPtr[32] & 3) != 3)
         throw RkVolumeException {RkVolumeException::RVET_NO_FILESYSTEM}; // there are missings sectors on the track
 
+    // a VTOC byte holds the bits of the track sectors, they are inverted and packed into the bitmap
+    memset(m_freeMap, 0, sizeof(m_freeMap));
     for (int t = 0; t < RK_TRACKCNT; t++) {
-        int bt = vtocPtr[t];
-        for (int s = 0; s < RK_SECTTRCNT; s++) {
-            m_sectors[t][s].allocated = bt & 1;
-            allocated += bt & 1;
-            bt >>= 1;
-        }
+        uint64_t freeBits = ~vtocPtr[t] & ((1 << RK_SECTTRCNT) - 1);
+        int bit = t * RK_SECTTRCNT;
+        m_freeMap[bit / 64] |= freeBits << (bit % 64);
+        if (bit % 64 > 64 - RK_SECTTRCNT)
+            m_freeMap[bit / 64 + 1] |= freeBits >> (64 - bit % 64);
     }
 
-    m_freeSectors = RK_SECTCNT - allocated;
+    m_freeSectors = 0;
+    for (auto word: m_freeMap)
+        m_freeSectors += __builtin_popcountll(word);
 }
 
 
 void RkVolume::readDir()
 {
-    m_fileList.clear();
+    m_files.clear();
+    m_dirSectors.clear();
     m_freeDirEntries = 0;
 
     int dirTrack = 32;
     int dirSector = 1;
 
-    int dirSectors = 0;
     int dirEntriesUsed = 0;
 
     do {
-        uint8_t* sectorData = m_sectors[dirTrack][dirSector].ptr;
+        uint8_t* sectorData = getSector(dirTrack, dirSector).ptr;
 
         int pos = 7;
 
-        dirSectors++;
+        m_dirSectors.push_back((dirTrack << 8) | dirSector);
 
         while (pos < RK_DATASECT - 21 && sectorData[pos]) {
             if (sectorData[pos] == 0xFF) {
@@ -179,98 +309,282 @@ void RkVolume::readDir()
             }
 
             RkFileInfo fileInfo;
+            parseDirEntry(sectorData, dirTrack, dirSector, pos, fileInfo);
+            m_files.push_back(fileInfo);
+
+            pos += 21;
+            dirEntriesUsed++;
+        }
+
+        dirTrack = sectorData[0];
+        dirSector = sectorData[1];
 
-            fileInfo.dirTrack = dirTrack;
-            fileInfo.dirSector = dirSector;
-            fileInfo.dirOffset = pos;
+    } while (dirTrack || dirSector);
 
-            if (!sectorData[pos + 9])
-                fileInfo.fileName.append((char*)(sectorData + pos));
-             else
-                fileInfo.fileName.append((char*)(sectorData + pos), 10);
+    m_freeDirEntries = m_dirSectors.size() * 24 - dirEntriesUsed;
 
-            pos += 11;
+    readDirFreeMap();
+    buildFileIndex();
+}
 
-            if (sectorData[pos])
-                fileInfo.fileName.push_back('.');
 
-            if (!sectorData[pos + 2])
-                fileInfo.fileName.append((char*)(sectorData + pos));
-             else
-                fileInfo.fileName.append((char*)(sectorData + pos), 3);
+// the entries which may be taken by allocateDirEntry(): deleted or never used ones
+void RkVolume::readDirFreeMap()
+{
+    m_freeDirMap.assign((m_dirSectors.size() * 24 + 63) / 64, 0);
+
+    for (size_t i = 0; i < m_dirSectors.size(); i++) {
+        const uint8_t* sectorData = m_sectors[m_dirSectors[i] >> 8][m_dirSectors[i] & 0xFF].ptr;
+        for (int n = 0; n < 24; n++) {
+            uint8_t firstByte = sectorData[7 + n * 21];
+            if (firstByte == 0 || firstByte == 0xFF)
+                m_freeDirMap[(i * 24 + n) / 64] |= 1ULL << ((i * 24 + n) % 64);
+        }
+    }
+}
 
-            pos += 3;
 
-            fileInfo.tList = sectorData[pos++];
-            fileInfo.sList = sectorData[pos++];
+void RkVolume::parseDirEntry(const uint8_t* sectorData, int track, int sector, int pos, RkFileInfo& fileInfo)
+{
+    fileInfo.dirTrack = track;
+    fileInfo.dirSector = sector;
+    fileInfo.dirOffset = pos;
 
-            fileInfo.addr = sectorData[pos] + (sectorData[pos + 1] << 8);
-            pos += 2;
+    memset(fileInfo.fileName, 0, RK_FILENAMELEN);
+    char* name = fileInfo.fileName;
 
-            fileInfo.sCount = sectorData[pos] + (sectorData[pos + 1] << 8);
-            pos += 2;
+    int len = strnlen((const char*)(sectorData + pos), 10);
+    memcpy(name, sectorData + pos, len);
+    name += len;
 
-            fileInfo.attr = sectorData[pos++];
+    pos += 11;
 
-            m_fileList.push_back(fileInfo);
+    if (sectorData[pos])
+        *name++ = '.';
 
-            dirEntriesUsed++;
-        }
+    memcpy(name, sectorData + pos, strnlen((const char*)(sectorData + pos), 3));
 
-        dirTrack = sectorData[0];
-        dirSector = sectorData[1];
+    pos += 3;
 
-    } while (dirTrack || dirSector);
+    fileInfo.tList = sectorData[pos++];
+    fileInfo.sList = sectorData[pos++];
 
-    m_freeDirEntries = dirSectors * 24 - dirEntriesUsed;
+    fileInfo.addr = sectorData[pos] + (sectorData[pos + 1] << 8);
+    pos += 2;
 
-    m_fileList.sort([](const auto& x, const auto& y) {return x.fileName < y.fileName;});
+    fileInfo.sCount = sectorData[pos] + (sectorData[pos + 1] << 8);
+    pos += 2;
 
-    calcSizes();
+    fileInfo.attr = sectorData[pos];
+
+    fileInfo.fileSize = -1;
 }
 
 
-void RkVolume::calcSizes()
+static unsigned hashFileName(const char* fileName)
 {
-    for (auto& fi: m_fileList) {
-        int t = fi.tList;
-        int s = fi.sList;
+    uint64_t lo, hi;
+    memcpy(&lo, fileName, 8);
+    memcpy(&hi, fileName + 8, 8);
+    uint64_t hash = (lo ^ (hi * 0x9E3779B97F4A7C15ULL)) * 0xFF51AFD7ED558CCDULL;
+    return unsigned(hash >> 32);
+}
 
-        int len = 0;
 
-        do {
-            uint8_t* ptr = m_sectors[t][s].ptr;
-            int sectorSize = m_sectors[t][s].len;
+static bool fileNameLess(const RkFileInfo& x, const RkFileInfo& y)
+{
+    return memcmp(x.fileName, y.fileName, RK_FILENAMELEN) < 0;
+}
 
-            t = ptr[0];
-            s = ptr[1];
 
-            if (t >= RK_TRACKCNT || s >= RK_SECTTRCNT)
-                throw RkVolumeException {RkVolumeException::RVET_SECTOR_NOT_FOUND, t, s};
+void RkVolume::buildFileIndex()
+{
+    int nFiles = m_files.size();
 
-            int pos = 2;
-            while (pos <= sectorSize - 2) {
-                int nextTrack = ptr[pos++];
-                int nextSector = ptr[pos++];
+    m_sortedFiles.resize(nFiles);
+    for (int i = 0; i < nFiles; i++)
+        m_sortedFiles[i] = i;
+    stable_sort(m_sortedFiles.begin(), m_sortedFiles.end(), [this](uint16_t x, uint16_t y) {
+        return fileNameLess(m_files[x], m_files[y]);
+    });
 
-                if (nextTrack >= RK_TRACKCNT || nextSector >= RK_SECTTRCNT)
-                    throw RkVolumeException {RkVolumeException::RVET_SECTOR_NOT_FOUND, nextTrack, nextSector};
+    buildFileHash();
+}
 
-                if (nextTrack || nextSector)
-                    len += m_sectors[nextTrack][nextSector].len;
-                else
-                    break;
+
+void RkVolume::buildFileHash()
+{
+    // at most half full
+    unsigned size = 16;
+    while (size < unsigned(m_files.size()) * 2)
+        size *= 2;
+    m_fileHash.assign(size, 0);
+
+    // the first one of the files with the same name in the sorted order is found
+    for (auto n: m_sortedFiles)
+        insertFileHash(n);
+}
+
+
+void RkVolume::insertFileHash(int n)
+{
+    unsigned mask = m_fileHash.size() - 1;
+    unsigned slot = hashFileName(m_files[n].fileName) & mask;
+    while (m_fileHash[slot] && memcmp(m_files[m_fileHash[slot] - 1].fileName, m_files[n].fileName, RK_FILENAMELEN))
+        slot = (slot + 1) & mask;
+    if (!m_fileHash[slot])
+        m_fileHash[slot] = n + 1;
+}
+
+
+// the slot of the file or the empty slot where the probing ends if it's not in the hash
+unsigned RkVolume::findFileHashSlot(int n)
+{
+    unsigned mask = m_fileHash.size() - 1;
+    unsigned slot = hashFileName(m_files[n].fileName) & mask;
+    while (m_fileHash[slot] && m_fileHash[slot] != n + 1)
+        slot = (slot + 1) & mask;
+    return slot;
+}
+
+
+// Adds the new directory entry to the table, the sorted list and the hash
+void RkVolume::addFile(const RkFileInfo& fileInfo)
+{
+    int n = m_files.size();
+    m_files.push_back(fileInfo);
+
+    auto it = upper_bound(m_sortedFiles.begin(), m_sortedFiles.end(), n, [this](uint16_t x, uint16_t y) {
+        return fileNameLess(m_files[x], m_files[y]);
+    });
+    m_sortedFiles.insert(it, n);
+
+    if (m_files.size() * 2 > m_fileHash.size())
+        buildFileHash();
+    else
+        insertFileHash(n);
+}
+
+
+// Removes the entry from the table, the last entry takes its place
+void RkVolume::removeFile(int n)
+{
+    auto cmp = [this](uint16_t x, uint16_t y) {return fileNameLess(m_files[x], m_files[y]);};
+
+    auto range = equal_range(m_sortedFiles.begin(), m_sortedFiles.end(), n, cmp);
+    auto sortedPos = find(range.first, range.second, n);
+
+    unsigned mask = m_fileHash.size() - 1;
+    unsigned slot = findFileHashSlot(n);
+    if (m_fileHash[slot]) {
+        // the hash holds the first one of the files with the same name, the next one becomes
+        // visible. Otherwise the slot is freed shifting back the rest of the probe sequence.
+        if (sortedPos + 1 != range.second)
+            m_fileHash[slot] = *(sortedPos + 1) + 1;
+        else {
+            m_fileHash[slot] = 0;
+            for (unsigned next = (slot + 1) & mask; m_fileHash[next]; next = (next + 1) & mask) {
+                unsigned home = hashFileName(m_files[m_fileHash[next] - 1].fileName) & mask;
+                if (((next - home) & mask) >= ((next - slot) & mask)) {
+                    m_fileHash[slot] = m_fileHash[next];
+                    m_fileHash[next] = 0;
+                    slot = next;
+                }
             }
-        } while (t || s);
-        fi.fileSize = len;
+        }
+    }
+
+    m_sortedFiles.erase(sortedPos);
+
+    int last = m_files.size() - 1;
+    if (n != last) {
+        slot = findFileHashSlot(last);
+        if (m_fileHash[slot])
+            m_fileHash[slot] = n + 1;
+
+        range = equal_range(m_sortedFiles.begin(), m_sortedFiles.end(), last, cmp);
+        *find(range.first, range.second, last) = n;
+
+        m_files[n] = m_files[last];
     }
+    m_files.pop_back();
+}
+
+
+// case insensitive, nullptr if not found
+RkFileInfo* RkVolume::findFile(const string& fileName)
+{
+    if (fileName.size() >= RK_FILENAMELEN || m_fileHash.empty())
+        return nullptr;
+
+    char key[RK_FILENAMELEN] = {};
+    for (size_t i = 0; i < fileName.size(); i++)
+        key[i] = toupper(fileName[i]);
+
+    unsigned mask = m_fileHash.size() - 1;
+    for (unsigned slot = hashFileName(key) & mask; m_fileHash[slot]; slot = (slot + 1) & mask) {
+        RkFileInfo& fi = m_files[m_fileHash[slot] - 1];
+        if (!memcmp(fi.fileName, key, RK_FILENAMELEN))
+            return &fi;
+    }
+
+    return nullptr;
+}
+
+
+// walks the T/S lists of the file, so the size is calculated on the first request only
+void RkVolume::calcSize(RkFileInfo& fi)
+{
+    if (fi.fileSize >= 0)
+        return;
+
+    int t = fi.tList;
+    int s = fi.sList;
+
+    int len = 0;
+
+    do {
+        RkSector& tslist = getSector(t, s);
+        uint8_t* ptr = tslist.ptr;
+        int sectorSize = tslist.len;
+
+        t = ptr[0];
+        s = ptr[1];
+
+        if (t >= RK_TRACKCNT || s >= RK_SECTTRCNT)
+            throw RkVolumeException {RkVolumeException::RVET_SECTOR_NOT_FOUND, t, s};
+
+        int pos = 2;
+        while (pos <= sectorSize - 2) {
+            int nextTrack = ptr[pos++];
+            int nextSector = ptr[pos++];
+
+            if (nextTrack >= RK_TRACKCNT || nextSector >= RK_SECTTRCNT)
+                throw RkVolumeException {RkVolumeException::RVET_SECTOR_NOT_FOUND, nextTrack, nextSector};
+
+            if (nextTrack || nextSector)
+                len += getSector(nextTrack, nextSector).len;
+            else
+                break;
+        }
+    } while (t || s);
+
+    fi.fileSize = len;
 }
 
 
-std::list<RkFileInfo>* RkVolume::getFileList()
+vector<const RkFileInfo*> RkVolume::getFileList(bool withSizes)
 {
     readDisk();
-    return &m_fileList;
+
+    vector<const RkFileInfo*> fileList;
+    for (auto n: m_sortedFiles) {
+        if (withSizes)
+            calcSize(m_files[n]);
+        fileList.push_back(&m_files[n]);
+    }
+
+    return fileList;
 }
 
 
@@ -292,10 +606,9 @@ uint8_t* RkVolume::readFile(std::string fileName, int& len, uint16_t& start)
 {
     readDisk();
 
-    std::transform(fileName.begin(), fileName.end(), fileName.begin(), ::toupper);
-
-    auto fi = find_if(m_fileList.begin(), m_fileList.end(), [fileName](const auto& x) {return fileName == x.fileName;});
-    if (fi != m_fileList.end()) {
+    RkFileInfo* fi = findFile(fileName);
+    if (fi) {
+        calcSize(*fi);
         len = fi->fileSize;
         start = fi->addr;
         if (len == 0) return nullptr;
@@ -311,8 +624,9 @@ uint8_t* RkVolume::readFile(std::string fileName, int& len, uint16_t& start)
             throw RkVolumeException {RkVolumeException::RVET_SECTOR_NOT_FOUND, t, s};
 
         do {
-            uint8_t* ptr = m_sectors[t][s].ptr;
-            int sectorSize = m_sectors[t][s].len;
+            RkSector& tslist = getSector(t, s);
+            uint8_t* ptr = tslist.ptr;
+            int sectorSize = tslist.len;
 
             t = ptr[0];
             s = ptr[1];
@@ -329,9 +643,10 @@ uint8_t* RkVolume::readFile(std::string fileName, int& len, uint16_t& start)
                     throw RkVolumeException {RkVolumeException::RVET_SECTOR_NOT_FOUND, nextTrack, nextSector};
 
                 if (nextTrack || nextSector) {
-                    int toRead = m_sectors[nextTrack][nextSector].len;
+                    RkSector& dataSector = getSector(nextTrack, nextSector);
+                    int toRead = dataSector.len;
                     if (toRead <= left) {
-                        memcpy(buf + bufPos, m_sectors[nextTrack][nextSector].ptr, toRead);
+                        memcpy(buf + bufPos, dataSector.ptr, toRead);
                         bufPos += toRead;
                         left -= toRead;
                     }
@@ -347,82 +662,77 @@ uint8_t* RkVolume::readFile(std::string fileName, int& len, uint16_t& start)
 }
 
 
-void RkVolume::allocateSector(int& track, int& sector)
+// Allocates the first count free sectors at once, they are returned in the allocation order
+void RkVolume::reserveSectors(int count, vector<pair<int, int>>& sectors)
 {
-    if (!m_freeSectors)
+    if (count > m_freeSectors)
         throw RkVolumeException {RkVolumeException::RVET_DISK_FULL};
 
-    for (int t = 0; t < RK_TRACKCNT; t++)
-        for (int s = 0; s < RK_SECTTRCNT; s++)
-            if (!m_sectors[t][s].allocated) {
-                memset(m_sectors[t][s].ptr, 0, RK_DATASECT);
-                track = t;
-                sector = s;
-                m_sectors[t][s].dirty = true;
-                m_sectors[t][s].allocated = true;
-                m_sectors[32][0].ptr[t] |= (1 << s);
-                m_sectors[32][0].dirty = true;
-                --m_freeSectors;
-                return;
-            }
-
-    throw RkVolumeException {RkVolumeException::RVET_DISK_FULL};
+    sectors.clear();
+    sectors.reserve(count);
+
+    for (int i = 0; count; i++) {
+        uint64_t word = m_freeMap[i];
+        for (; word && count; count--) {
+            int bit = i * 64 + __builtin_ctzll(word);
+            word &= word - 1;
+            int t = bit / RK_SECTTRCNT;
+            int s = bit % RK_SECTTRCNT;
+            allocateSpecificSector(t, s);
+            sectors.push_back({t, s});
+        }
+    }
 }
 
 
 void RkVolume::allocateSpecificSector(int track, int sector)
 {
-    if (!m_sectors[track][sector].allocated)
+    RkSector& sect = getSector(track, sector);
+
+    int bit = track * RK_SECTTRCNT + sector;
+    if (m_freeMap[bit / 64] & (1ULL << (bit % 64))) {
+        m_freeMap[bit / 64] &= ~(1ULL << (bit % 64));
         --m_freeSectors;
+    }
 
-    memset(m_sectors[track][sector].ptr, 0, RK_DATASECT);
-    m_sectors[track][sector].dirty = true;
-    m_sectors[track][sector].allocated = true;
-    m_sectors[32][0].ptr[track] |= (1 << sector);
-    m_sectors[32][0].dirty = true;
+    memset(sect.ptr, 0, RK_DATASECT);
+    markSectorDirty(track, sector);
+    getSector(32, 0).ptr[track] |= (1 << sector);
+    markSectorDirty(32, 0);
 }
 
 
 void RkVolume::freeSector(int track, int sector)
 {
-    if (m_sectors[track][sector].allocated) {
-        m_sectors[track][sector].allocated = false;
-        m_sectors[track][sector].dirty = true;
-        m_sectors[32][0].ptr[track] &= ~(1 << sector);
-        m_sectors[32][0].dirty = true;
+    getSector(track, sector); // checks that the sector exists
+
+    int bit = track * RK_SECTTRCNT + sector;
+    if (!(m_freeMap[bit / 64] & (1ULL << (bit % 64)))) {
+        m_freeMap[bit / 64] |= 1ULL << (bit % 64);
+        markSectorDirty(track, sector);
+        getSector(32, 0).ptr[track] &= ~(1 << sector);
+        markSectorDirty(32, 0);
         ++m_freeSectors;
     }
 }
 
 
-uint8_t* RkVolume::allocateDirEntry()
+// Takes the first free directory entry, returns its position
+uint8_t* RkVolume::allocateDirEntry(int& track, int& sector, int& pos)
 {
-    int track = 32;
-    int sector = 1;
+    for (size_t i = 0; i < m_freeDirMap.size(); i++)
+        if (m_freeDirMap[i]) {
+            int entry = i * 64 + __builtin_ctzll(m_freeDirMap[i]);
+            m_freeDirMap[i] &= m_freeDirMap[i] - 1;
 
-    uint8_t* sectorData = m_sectors[track][sector].ptr;
+            track = m_dirSectors[entry / 24] >> 8;
+            sector = m_dirSectors[entry / 24] & 0xFF;
+            pos = 7 + entry % 24 * 21;
 
-    do {
-        int pos = 7;
-
-        while (pos < RK_DATASECT - 21) {
-            if (sectorData[pos] == 0 || sectorData[pos] == 0xFF) {
-                m_sectors[track][sector].dirty = true;
-                return sectorData + pos;
-            }
-            pos += 21;
+            markSectorDirty(track, sector);
+            return getSector(track, sector).ptr + pos;
         }
 
-        track = sectorData[0];
-        sector = sectorData[1];
-
-        if (track >= RK_TRACKCNT || sector >= RK_SECTTRCNT)
-            throw RkVolumeException {RkVolumeException::RVET_SECTOR_NOT_FOUND, track, sector};
-
-        sectorData = m_sectors[track][sector].ptr;
-
-    } while (track || sector);
-
     throw RkVolumeException {RkVolumeException::RVET_DIR_FULL};
 }
 
@@ -439,23 +749,40 @@ void RkVolume::writeFile(string fileName, uint8_t* data, int size, uint16_t addr
         periodPos = 10;
     string sBaseName = fileName.substr(0, periodPos);
 
-    if (find_if(m_fileList.begin(), m_fileList.end(), [fileName](const auto& x) {return fileName == x.fileName;}) != m_fileList.end()) {
-        if (allowOverwrite)
-            deleteFile(fileName);
-        else
-            throw RkVolumeException {RkVolumeException::RVET_FILE_EXISTS};
-    }
+    RkFileInfo* oldFile = findFile(fileName);
+    if (oldFile && !allowOverwrite)
+        throw RkVolumeException {RkVolumeException::RVET_FILE_EXISTS};
 
     int sectorsNeeded = (size + 511) / RK_DATASECT;
     if (sectorsNeeded == 0)
         sectorsNeeded = 1;
     sectorsNeeded += (sectorsNeeded + 253) / 254;
 
-    if (sectorsNeeded > m_freeSectors)
+    // the sectors of the overwritten file are free for the new one, but it's deleted only if the new one fits
+    int freeSectors = m_freeSectors;
+    if (oldFile) {
+        vector<pair<int, int>> oldSectors;
+        getFileSectors(*oldFile, oldSectors);
+        for (const auto& sector: oldSectors) {
+            int bit = sector.first * RK_SECTTRCNT + sector.second;
+            if (!(m_freeMap[bit / 64] & (1ULL << (bit % 64))))
+                freeSectors++;
+        }
+    }
+
+    // a T/S list sector holds 126 sectors, the actually needed space is checked before anything is changed
+    int dataSectors = (size + 511) / RK_DATASECT;
+    int tslistSectors = 1 + dataSectors / 126;
+    if (sectorsNeeded > freeSectors || dataSectors + tslistSectors > freeSectors)
         // no free space
         throw RkVolumeException {RkVolumeException::RVET_DISK_FULL};
 
-    uint8_t* dir = allocateDirEntry();
+    if (oldFile)
+        deleteFile(fileName);
+
+    int dirTrack, dirSector, dirPos;
+    uint8_t* dir = allocateDirEntry(dirTrack, dirSector, dirPos);
+    bool dirEnd = *dir == 0;
 
     strncpy(reinterpret_cast<char*>(dir), sBaseName.c_str(), 10);
     dir[10] = 0;
@@ -464,9 +791,14 @@ void RkVolume::writeFile(string fileName, uint8_t* data, int size, uint16_t addr
     strncpy(reinterpret_cast<char*>(dir), sExt.c_str(), 3);
     dir += 3;
 
-    int tslistTrack, tslistSector;
+    // the sectors are used in the allocation order: T/S list, 126 data sectors, T/S list...
+    vector<pair<int, int>> sectors;
+    reserveSectors(dataSectors + tslistSectors, sectors);
+    auto nextSector = sectors.begin();
 
-    allocateSector(tslistTrack, tslistSector);
+    int tslistTrack = nextSector->first;
+    int tslistSector = nextSector->second;
+    ++nextSector;
 
     *dir++ = tslistTrack;
     *dir++ = tslistSector;
@@ -483,21 +815,25 @@ void RkVolume::writeFile(string fileName, uint8_t* data, int size, uint16_t addr
 
     int left = size;
 
-    uint8_t* tslistPtr = m_sectors[tslistTrack][tslistSector].ptr;
+    RkSector* tslist = &getSector(tslistTrack, tslistSector);
+    tslist->len = RK_DATASECT;
+    uint8_t* tslistPtr = tslist->ptr;
     tslistPtr[0] = 0;
     tslistPtr[1] = 0;
 
     int tslistPos = 2;
 
-    int track, sector;
     while (left > 0) {
-        allocateSector(track, sector);
+        int track = nextSector->first;
+        int sector = nextSector->second;
+        ++nextSector;
 
-        uint8_t* ptr = m_sectors[track][sector].ptr;
+        RkSector& dataSector = getSector(track, sector);
+        uint8_t* ptr = dataSector.ptr;
 
         int bytesToCopy = left > RK_DATASECT ? RK_DATASECT : left;
         memcpy(reinterpret_cast<char*>(ptr), data, bytesToCopy);
-        m_sectors[track][sector].len = bytesToCopy;
+        dataSector.len = bytesToCopy;
         if (bytesToCopy < RK_DATASECT)
             memset(ptr + bytesToCopy, 0, RK_DATASECT - bytesToCopy + 2); // + CS: 2 bytes
         data += bytesToCopy;
@@ -510,10 +846,14 @@ void RkVolume::writeFile(string fileName, uint8_t* data, int size, uint16_t addr
             tslistPtr[254] = 0;
             tslistPtr[255] = 0;
 
-            allocateSector(tslistTrack, tslistSector);
+            tslistTrack = nextSector->first;
+            tslistSector = nextSector->second;
+            ++nextSector;
             tslistPtr[0] = tslistTrack;
             tslistPtr[1] = tslistSector;
-            uint8_t* tslistPtr = m_sectors[tslistTrack][tslistSector].ptr;
+            tslist = &getSector(tslistTrack, tslistSector);
+            tslist->len = RK_DATASECT;
+            tslistPtr = tslist->ptr;
             tslistPtr[0] = 0;
             tslistPtr[1] = 0;
             tslistPos = 2;
@@ -522,8 +862,25 @@ void RkVolume::writeFile(string fileName, uint8_t* data, int size, uint16_t addr
     tslistPtr[tslistPos] = 0;
     tslistPtr[tslistPos + 1] = 0;
 
+    // If the entry was the end of directory mark, the entries following it in the sector
+    // (up to the next mark) become visible as well
+    const uint8_t* sectorData = getSector(dirTrack, dirSector).ptr;
+    for (int pos = dirPos; pos < RK_DATASECT - 21 && sectorData[pos]; pos += 21) {
+        if (sectorData[pos] == 0xFF)
+            continue;
+
+        RkFileInfo fileInfo;
+        parseDirEntry(sectorData, dirTrack, dirSector, pos, fileInfo);
+        if (pos == dirPos)
+            fileInfo.fileSize = size;
+        addFile(fileInfo);
+        m_freeDirEntries--;
+
+        if (!dirEnd)
+            break;
+    }
+
     updateSectors();
-    readDir();
 }
 
 
@@ -531,43 +888,25 @@ RkFileInfo* RkVolume::getFileInfo(std::string fileName)
 {
     readDisk();
 
-    std::transform(fileName.begin(), fileName.end(), fileName.begin(), ::toupper);
-
-    auto fi = find_if(m_fileList.begin(), m_fileList.end(), [fileName](const auto& x) {return fileName == x.fileName;});
-    if (fi != m_fileList.end()) {
-        return &*fi;
+    RkFileInfo* fi = findFile(fileName);
+    if (fi) {
+        calcSize(*fi);
+        return fi;
     } else
         throw RkVolumeException {RkVolumeException::RVET_FILE_NOT_FOUND};
 }
 
 
-void RkVolume::deleteFile(std::string fileName)
+// The T/S list and data sectors of the file, the whole chain is validated
+void RkVolume::getFileSectors(const RkFileInfo& fi, vector<pair<int, int>>& sectors)
 {
-    readDisk();
-
-    std::transform(fileName.begin(), fileName.end(), fileName.begin(), ::toupper);
-
-    auto fi = find_if(m_fileList.begin(), m_fileList.end(), [fileName](const auto& x) {return fileName == x.fileName;});
-    if (fi == m_fileList.end())
-        throw RkVolumeException {RkVolumeException::RVET_FILE_NOT_FOUND};
-
-    uint8_t* dir = m_sectors[fi->dirTrack][fi->dirSector].ptr + fi->dirOffset;
-
-    dir[10] = dir[0];
-    dir[0] = 0xFF;
-
-    int t = fi->tList;
-    int s = fi->sList;
-
-    if (t >= RK_TRACKCNT || s >= RK_SECTTRCNT)
-        throw RkVolumeException {RkVolumeException::RVET_SECTOR_NOT_FOUND, t, s};
+    int t = fi.tList;
+    int s = fi.sList;
 
     do {
-        uint8_t* ptr = m_sectors[t][s].ptr;
-        int sectorSize = m_sectors[t][s].len;
-
-        if (t >= RK_TRACKCNT || s >= RK_SECTTRCNT)
-            throw RkVolumeException {RkVolumeException::RVET_SECTOR_NOT_FOUND, t, s};
+        RkSector& tslist = getSector(t, s);
+        uint8_t* ptr = tslist.ptr;
+        int sectorSize = tslist.len;
 
         int tslistPos = 2;
         while (tslistPos <= sectorSize - 2) {
@@ -577,19 +916,51 @@ void RkVolume::deleteFile(std::string fileName)
             if (nextT >= RK_TRACKCNT || nextS >= RK_SECTTRCNT)
                 throw RkVolumeException {RkVolumeException::RVET_SECTOR_NOT_FOUND, nextT, nextS};
 
-            if (nextT || nextS)
-                freeSector(nextT, nextS);
+            if (nextT || nextS) {
+                getSector(nextT, nextS);
+                sectors.push_back({nextT, nextS});
+            }
             else
                 break;
         }
-        freeSector(t, s);
+        sectors.push_back({t, s});
 
         t = ptr[0];
         s = ptr[1];
     } while (t || s);
+}
+
+
+void RkVolume::deleteFile(std::string fileName)
+{
+    readDisk();
+
+    RkFileInfo* fi = findFile(fileName);
+    if (!fi)
+        throw RkVolumeException {RkVolumeException::RVET_FILE_NOT_FOUND};
+
+    // the whole chain is checked before anything is changed
+    vector<pair<int, int>> sectors;
+    getFileSectors(*fi, sectors);
+
+    RkSector& dirSector = getSector(fi->dirTrack, fi->dirSector);
+    uint8_t* dir = dirSector.ptr + fi->dirOffset;
+
+    dir[10] = dir[0];
+    dir[0] = 0xFF;
+    markSectorDirty(fi->dirTrack, fi->dirSector);
+
+    int dirSectorIndex = find(m_dirSectors.begin(), m_dirSectors.end(), (fi->dirTrack << 8) | fi->dirSector) - m_dirSectors.begin();
+    int dirEntry = dirSectorIndex * 24 + (fi->dirOffset - 7) / 21;
+    m_freeDirMap[dirEntry / 64] |= 1ULL << (dirEntry % 64);
+    m_freeDirEntries++;
+
+    removeFile(fi - m_files.data());
+
+    for (const auto& sector: sectors)
+        freeSector(sector.first, sector.second);
 
     updateSectors();
-    readDir();
 }
 
 
@@ -597,14 +968,11 @@ void RkVolume::setAttributes(std::string fileName, uint8_t attr)
 {
     readDisk();
 
-    std::transform(fileName.begin(), fileName.end(), fileName.begin(), ::toupper);
-
-    auto fi = find_if(m_fileList.begin(), m_fileList.end(), [fileName](const auto& x) {return fileName == x.fileName;});
-    if (fi != m_fileList.end()) {
+    RkFileInfo* fi = findFile(fileName);
+    if (fi) {
         fi->attr = attr;
-        RkSector* sector = &m_sectors[fi->dirTrack][fi->dirSector];
-        sector->ptr[fi->dirOffset + 20] = attr;
-        sector->dirty = true;;
+        getSector(fi->dirTrack, fi->dirSector).ptr[fi->dirOffset + 20] = attr;
+        markSectorDirty(fi->dirTrack, fi->dirSector);
     } else
         throw RkVolumeException {RkVolumeException::RVET_FILE_NOT_FOUND};
 
@@ -671,44 +1039,75 @@ void RkVolume::format(int directorySize)
         }
     }
 
-    readSectors();
+    m_image->markDirty(0, m_image->getSize());
+
+    // the tracks are found again on access
+    for (int t = 0; t < RK_TRACKCNT; t++)
+        m_trackRead[t] = false;
+    m_dirtySectors.clear();
+    memset(m_dirtyMap, 0, sizeof(m_dirtyMap));
 
     allocateSpecificSector(32, 0);
-    m_sectors[32][0].len = RK_TRACKCNT;
+    getSector(32, 0).len = RK_TRACKCNT;
 
     for (int i = 1; i <= directorySize; i++) {
         int t = 32 + i / 5;
         int s = i % 5;
         allocateSpecificSector(t, s);
         if (i != directorySize) {
-            m_sectors[t][s].ptr[0] = 32 + (i + 1) / 5;
-            m_sectors[t][s].ptr[1] = (i + 1) % 5;
+            getSector(t, s).ptr[0] = 32 + (i + 1) / 5;
+            getSector(t, s).ptr[1] = (i + 1) % 5;
         }
     }
 
     updateSectors();
+
+    readVtoc();
+    readDir();
+    m_diskRead = true;
 }
 
 
+void RkVolume::markSectorDirty(int track, int sector)
+{
+    int n = track * RK_SECTTRCNT + sector;
+    if (!(m_dirtyMap[n / 64] & (1ULL << (n % 64)))) {
+        m_dirtyMap[n / 64] |= 1ULL << (n % 64);
+        m_dirtySectors.push_back(n);
+    }
+}
+
+
+// Writes the lengths and checksums of the changed sectors
 void RkVolume::updateSectors()
 {
-    for (int t = 0; t < RK_TRACKCNT; t++)
-        for(int s = 0; s < RK_SECTTRCNT; s++)
-            if (m_sectors[t][s].dirty) {
-                int len = m_sectors[t][s].len;
-                uint8_t* ptr = m_sectors[t][s].ptr;
-                uint16_t cs = 0;
-                ptr[-3] = m_sectors[t][s].len & 0xFF;
-                ptr[-2] = m_sectors[t][s].len >> 8;
-                for (int i = 0; i < len; i++)
-                    cs += ptr[i];
-                ptr[len] = cs & 0xFF;
-                ptr[len + 1] = cs >> 8;
-            }
+    for (auto n: m_dirtySectors) {
+        RkSector& sect = m_sectors[n / RK_SECTTRCNT][n % RK_SECTTRCNT];
+        if (!m_trackRead[n / RK_SECTTRCNT] || !sect.ptr)
+            continue;
+
+        int len = sect.len;
+        uint8_t* ptr = sect.ptr;
+        ptr[-3] = len & 0xFF;
+        ptr[-2] = len >> 8;
+        uint16_t cs = calcRkuCs(ptr, len);
+        ptr[len] = cs & 0xFF;
+        ptr[len + 1] = cs >> 8;
+        // length, data (the whole sector buffer might be cleared) and checksum
+        m_image->markDirty(ptr - 3 - m_image->getData(), 3 + max(len, RK_DATASECT) + 2);
+    }
+
+    m_dirtySectors.clear();
+    memset(m_dirtyMap, 0, sizeof(m_dirtyMap));
 }
 
 
-void RkVolume::saveImage()
+size_t RkVolume::saveImage()
 {
-    m_image->updateAll();
+    size_t written = m_image->updateAll();
+
+    if (!m_indexFileName.empty() && m_diskRead)
+        saveIndex();
+
+    return written;
 }
@@ -18,7 +18,7 @@
 #ifndef RKVOLUME_H
 #define RKVOLUME_H
 
-#include <list>
+#include <vector>
 
 #include "volume.h"
 
@@ -34,12 +34,13 @@
 struct RkSector {
     uint8_t* ptr;
     uint16_t len;
-    bool dirty;
-    bool allocated;
 };
 
+#define RK_FILENAMELEN 16
+
+
 struct RkFileInfo {
-    std::string fileName;
+    char fileName[RK_FILENAMELEN];  // "NAME.EXT", padded with zeros, it's the lookup key as well
     uint8_t dirTrack;
     uint8_t dirSector;
     int dirOffset;
@@ -48,7 +49,7 @@ struct RkFileInfo {
     uint16_t sCount;
     uint8_t attr;
     uint16_t addr;
-    int fileSize;
+    int fileSize;   // -1 until calculated
 };
 
 class RkVolume : public Volume
@@ -72,11 +73,12 @@ public:
         int sector = 0;
     };
 
-    RkVolume(const std::string& fileName, ImageFileMode mode);
+    // useIndex: use and update the sidecar index file <fileName>.rdx (see rkindex.h)
+    RkVolume(const std::string& fileName, ImageFileMode mode, bool useIndex = false);
 
     bool isValid() override;
 
-    std::list<RkFileInfo>* getFileList();
+    std::vector<const RkFileInfo*> getFileList(bool withSizes = true); // sorted by name, the sizes are calculated on request
     RkFileInfo* getFileInfo(std::string fileName);
     int getFreeBlocks();
     int getFreeDirEntries();
@@ -87,29 +89,63 @@ public:
     void setAttributes(std::string fileName, uint8_t attr);
     void format(int directorySize = 4);
 
-    void saveImage();
+    size_t saveImage(); // returns the number of bytes written
 
 private:
     RkSector m_sectors[RK_TRACKCNT][RK_SECTTRCNT];
-    std::list<RkFileInfo> m_fileList;
 
+    // Directory table: the entries in directory order, their indexes sorted by name
+    // and an open addressing hash index of the names (entry index + 1, 0 - empty slot)
+    std::vector<RkFileInfo> m_files;
+    std::vector<uint16_t> m_sortedFiles;
+    std::vector<uint16_t> m_fileHash;
+
+    // Directory chain (track << 8 | sector) and its free entries, bit sector index * 24 + entry
+    std::vector<uint16_t> m_dirSectors;
+    std::vector<uint64_t> m_freeDirMap;
+
+    uint64_t m_freeMap[(RK_SECTCNT + 63) / 64] = {};   // free sectors, bit track * 5 + sector
     int m_freeSectors = 0;
+
+    // sectors changed since the last updateSectors() call, track * 5 + sector
+    std::vector<uint16_t> m_dirtySectors;
+    uint64_t m_dirtyMap[(RK_SECTCNT + 63) / 64] = {};
+
     int m_freeDirEntries = 0;
 
     bool m_diskRead = false;
+    bool m_trackRead[RK_TRACKCNT] = {};
+
+    std::string m_indexFileName;
 
     void readDisk();
+    bool loadIndex();
+    void saveIndex();
+    uint64_t calcIndexHash(const std::vector<uint16_t>& dirSectors);
 
-    void readSectors();
+    RkSector& getSector(int track, int sector); // reads the track on the first access
+    void readTrack(int track);
     void readVtoc();
     void readDir();
-    void calcSizes();
+    void readDirFreeMap();
+    void parseDirEntry(const uint8_t* sectorData, int track, int sector, int pos, RkFileInfo& fileInfo);
+    void calcSize(RkFileInfo& fi);
+    void getFileSectors(const RkFileInfo& fi, std::vector<std::pair<int, int>>& sectors);
+
+    void buildFileIndex();
+    void buildFileHash();
+    void insertFileHash(int n);
+    unsigned findFileHashSlot(int n);
+    void addFile(const RkFileInfo& fileInfo);
+    void removeFile(int n);
+    RkFileInfo* findFile(const std::string& fileName);
+    void markSectorDirty(int track, int sector);
     void updateSectors();
 
-    void allocateSector(int& track, int& sector);
+    void reserveSectors(int count, std::vector<std::pair<int, int>>& sectors);
     void allocateSpecificSector(int track, int sector);
     void freeSector(int track, int sector);
-    uint8_t* allocateDirEntry();
+    uint8_t* allocateDirEntry(int& track, int& sector, int& pos);
 };
 
 